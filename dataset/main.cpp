@@ -1,12 +1,15 @@
 #include <iostream>
 #include <random>
-#include <queue>
 #include <algorithm>
 #include <fstream>
 #include <vector>
 #include <chrono>
 #include <unordered_set>
 #include <cassert>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 class DatasetGenerator {
 public:
@@ -31,14 +34,12 @@ public:
     }
 
     /**
-     * 生成验证集，维度为 GROUND_TRUTH_DIM
+     * 生成验证集，维度为 GROUND_TRUTH_DIM；训练集从文件分块流式读取，不需要整体载入内存
      */
     void genGroundTruth() {
-        load_data(&base_path[0], base_data, base_num, base_dim);
-
         load_data(&query_path[0], query_data, query_num, query_dim);
 
-        gen_ground_truth(ground_path, GROUND_TRUTH_DIM, base_data, query_data, base_num, query_num);
+        gen_ground_truth_stream(ground_path, GROUND_TRUTH_DIM, base_path, query_data, query_num);
     }
 
     /**
@@ -266,6 +267,106 @@ private:
         return result;
     }
 
+    /**
+     * 一个查询点与连续存放的 num 个训练数据的距离，SSE2 下每次同时计算 4 个
+     */
+    void compare_block(const float *query, const float *block, unsigned num, unsigned dim, float *dists) {
+        unsigned i = 0;
+#ifdef __SSE2__
+        for (; i + 4 <= num; i += 4) {
+            const float *b0 = block + (size_t) i * dim;
+            const float *b1 = b0 + dim;
+            const float *b2 = b1 + dim;
+            const float *b3 = b2 + dim;
+            __m128 s = _mm_setzero_ps();
+            unsigned d = 0;
+            for (; d + 4 <= dim; d += 4) {
+                __m128 q = _mm_loadu_ps(query + d);
+                __m128 t0 = _mm_sub_ps(q, _mm_loadu_ps(b0 + d));
+                __m128 t1 = _mm_sub_ps(q, _mm_loadu_ps(b1 + d));
+                __m128 t2 = _mm_sub_ps(q, _mm_loadu_ps(b2 + d));
+                __m128 t3 = _mm_sub_ps(q, _mm_loadu_ps(b3 + d));
+                t0 = _mm_mul_ps(t0, t0);
+                t1 = _mm_mul_ps(t1, t1);
+                t2 = _mm_mul_ps(t2, t2);
+                t3 = _mm_mul_ps(t3, t3);
+                // 转置后按 compare 的顺序累加，结果与 compare 逐位一致
+                _MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+                s = _mm_add_ps(s, _mm_add_ps(_mm_add_ps(_mm_add_ps(t0, t1), t2), t3));
+            }
+            _mm_storeu_ps(dists + i, s);
+            for (; d < dim; d++) {
+                float t0 = query[d] - b0[d], t1 = query[d] - b1[d], t2 = query[d] - b2[d], t3 = query[d] - b3[d];
+                dists[i] += t0 * t0;
+                dists[i + 1] += t1 * t1;
+                dists[i + 2] += t2 * t2;
+                dists[i + 3] += t3 * t3;
+            }
+        }
+#endif
+        for (; i < num; i++) {
+            dists[i] = compare(query, block + (size_t) i * dim, dim);
+        }
+    }
+
+    /**
+     * 用一段连续的训练数据更新各查询点的 top-k 大顶堆：查询点按 QUERY_BLOCK 分块并行，
+     * 训练数据按 BASE_BLOCK 分块，块内所有查询复用同一块训练数据的缓存
+     *
+     * @param heaps 各查询点的大顶堆 (距离, 训练数据 id)，容量 k
+     * @param base 训练数据块
+     * @param base_offset 训练数据块首行的全局 id
+     */
+    void update_top_k(std::vector<std::vector<std::pair<float, unsigned>>> &heaps, unsigned k,
+                      const float *query_data, unsigned query_num, const float *base, unsigned base_offset,
+                      unsigned num, unsigned dim) {
+        const unsigned QUERY_BLOCK = 16;
+        const unsigned BASE_BLOCK = std::max(16u, 32768 / std::max(dim, 1u));
+
+#pragma omp parallel
+        {
+            std::vector<float> dists(BASE_BLOCK);
+#pragma omp for schedule(dynamic, 1)
+            for (int q0 = 0; q0 < (int) query_num; q0 += QUERY_BLOCK) {
+                unsigned q_end = std::min(query_num, q0 + QUERY_BLOCK);
+                for (unsigned b0 = 0; b0 < num; b0 += BASE_BLOCK) {
+                    unsigned b_num = std::min(BASE_BLOCK, num - b0);
+                    const float *block = base + (size_t) b0 * dim;
+                    for (unsigned q = q0; q < q_end; q++) {
+                        compare_block(query_data + (size_t) q * dim, block, b_num, dim, dists.data());
+                        auto &heap = heaps[q];
+                        for (unsigned b = 0; b < b_num; b++) {
+                            if (heap.size() < k) {
+                                heap.emplace_back(dists[b], base_offset + b0 + b);
+                                std::push_heap(heap.begin(), heap.end());
+                            } else if (dists[b] < heap.front().first) {
+                                std::pop_heap(heap.begin(), heap.end());
+                                heap.back() = std::pair<float, unsigned>(dists[b], base_offset + b0 + b);
+                                std::push_heap(heap.begin(), heap.end());
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * 由 top-k 大顶堆按距离升序写出验证集
+     */
+    void save_top_k(std::string &ground_path, std::vector<std::vector<std::pair<float, unsigned>>> &heaps,
+                    unsigned ground_dim, unsigned query_num) {
+        auto *groundtruth = new unsigned[(size_t) query_num * ground_dim];
+        for (unsigned i = 0; i < query_num; i++) {
+            std::sort_heap(heaps[i].begin(), heaps[i].end());
+            for (unsigned j = 0; j < ground_dim; j++) {
+                groundtruth[(size_t) i * ground_dim + j] = heaps[i][j].second;
+            }
+        }
+        save_data<unsigned>(&ground_path[0], groundtruth, query_num, ground_dim);
+        delete[] groundtruth;
+    }
+
     /**
      * 生成验证集
      *
@@ -277,28 +378,14 @@ private:
      */
     void gen_ground_truth(std::string ground_path, unsigned ground_dim, float *base_data, float *query_data,
                           unsigned base_num, unsigned query_num) {
+        if (base_num < ground_dim) {
+            std::cerr << "base num less than ground truth dim" << std::endl;
+            exit(-1);
+        }
 
         std::chrono::high_resolution_clock::time_point s = std::chrono::high_resolution_clock::now();
-        unsigned *groundtruth = new unsigned[query_num * ground_dim];
-
-#pragma omp parallel for
-        for (int i = 0; i < query_num; i++) {
-            //std::cout << "save : " << i << std::endl;
-            std::priority_queue<std::pair<float, unsigned>, std::vector<std::pair<float, unsigned>>, cmp> dist;
-            for (int j = 0; j < base_num; j++) {
-                float d = compare(query_data + query_dim * i, base_data + base_dim * j, base_dim);
-                dist.push(std::pair<float, unsigned>(d, j));
-            }
-
-            for (int j = 0; j < ground_dim; j++) {
-                std::pair<float, unsigned> p = dist.top();
-                dist.pop();
-                groundtruth[i * ground_dim + j] = p.second;
-//              std::cout << p.first << std::endl;
-//              std::cout << p.second << std::endl;
-            }
-//          std::cout << std::endl;
-        }
+        std::vector<std::vector<std::pair<float, unsigned>>> heaps(query_num);
+        update_top_k(heaps, ground_dim, query_data, query_num, base_data, 0, base_num, base_dim);
         std::chrono::high_resolution_clock::time_point e = std::chrono::high_resolution_clock::now();
 
         auto time = e - s;
@@ -307,16 +394,61 @@ private:
         // priority_queue : 19180940100
         // total          : 1514844795500
         std::cout << "time : " << time.count() << std::endl;
-        save_data<unsigned>(&ground_path[0], groundtruth, query_num, ground_dim);
+        save_top_k(ground_path, heaps, ground_dim, query_num);
     }
 
-    struct cmp {
-        template<typename T, typename U>
-        bool operator()(T const &left, U const &right) {
-            if (left.first > right.first) return true;
-            return false;
+    /**
+     * 生成验证集，训练集文件按 STREAM_CHUNK 行分块读入，内存占用与训练集规模无关
+     *
+     * @param ground_path 验证集保存路径
+     * @param base_path 训练集文件 (fvecs)
+     * @param query_data 测试集数据
+     * @param query_num 测试集个数
+     */
+    void gen_ground_truth_stream(std::string ground_path, unsigned ground_dim, const std::string &base_path,
+                                 float *query_data, unsigned query_num) {
+        const unsigned STREAM_CHUNK = 1 << 16;
+
+        std::ifstream in(base_path, std::ios::binary);
+        if (!in.is_open()) {
+            std::cerr << "open file error" << std::endl;
+            exit(-1);
         }
-    };
+        unsigned dim{};
+        in.read((char *) &dim, 4);
+        if (dim != query_dim) {
+            std::cerr << "base dim " << dim << " != query dim " << query_dim << std::endl;
+            exit(-1);
+        }
+        in.seekg(0, std::ios::end);
+        auto num = (unsigned) ((size_t) in.tellg() / (dim + 1) / 4);
+        in.seekg(0, std::ios::beg);
+        if (num < ground_dim) {
+            std::cerr << "base num less than ground truth dim" << std::endl;
+            exit(-1);
+        }
+        std::cout << "base num : " << num << std::endl;
+
+        std::chrono::high_resolution_clock::time_point s = std::chrono::high_resolution_clock::now();
+        std::vector<std::vector<std::pair<float, unsigned>>> heaps(query_num);
+        std::vector<float> chunk((size_t) STREAM_CHUNK * (dim + 1));
+        for (unsigned offset = 0; offset < num; offset += STREAM_CHUNK) {
+            unsigned chunk_num = std::min(STREAM_CHUNK, num - offset);
+            in.read((char *) chunk.data(), (size_t) chunk_num * (dim + 1) * sizeof(float));
+            // 去掉每行的维度头，使训练数据连续存放
+            for (unsigned i = 0; i < chunk_num; i++) {
+                std::memmove(chunk.data() + (size_t) i * dim, chunk.data() + (size_t) i * (dim + 1) + 1,
+                             dim * sizeof(float));
+            }
+            update_top_k(heaps, ground_dim, query_data, query_num, chunk.data(), offset, chunk_num, dim);
+        }
+        in.close();
+        std::chrono::high_resolution_clock::time_point e = std::chrono::high_resolution_clock::now();
+
+        auto time = e - s;
+        std::cout << "time : " << time.count() << std::endl;
+        save_top_k(ground_path, heaps, ground_dim, query_num);
+    }
 
     static bool test_cmp(const std::pair<float, unsigned> a, const std::pair<float, unsigned> b) {
         return a.first < b.first;
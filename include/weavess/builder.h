@@ -8,28 +8,66 @@
 #include "index.h"
 
 namespace weavess {
+    class ComponentSearchEntry;
+    class ComponentSearchRoute;
+
     class IndexBuilder {
     public:
         explicit IndexBuilder(const unsigned num_threads) {
             final_index_ = new Index();
+            final_index_->n_threads_ = num_threads;
             omp_set_num_threads(num_threads);
         }
 
-        virtual ~IndexBuilder() {
-            delete final_index_;
-        }
+        virtual ~IndexBuilder();
 
         IndexBuilder *load(char *data_file, char *query_file, char *ground_file, Parameters &parameters);
 
+        IndexBuilder *load_query(char *query_file, char *ground_file, Parameters &parameters);
+
+        IndexBuilder *load_labels(char *label_file);
+
         IndexBuilder *init(TYPE type, bool debug = false);
 
         IndexBuilder *save_graph(TYPE type, char *graph_file);
 
         IndexBuilder *load_graph(TYPE type, char *graph_file);
 
+        IndexBuilder *save_disk_index(TYPE type, char *disk_file);
+
+        IndexBuilder *load_disk_index(char *disk_file);
+
         IndexBuilder *refine(TYPE type, bool debug);
 
-        IndexBuilder *search(TYPE entry_type, TYPE route_type, bool IsControlRecall);
+        IndexBuilder *search(TYPE entry_type, TYPE route_type, bool IsControlRecall, unsigned K = 10);
+
+        IndexBuilder *search(TYPE entry_type, TYPE route_type, const float *queries, unsigned query_num, unsigned K,
+                             unsigned *ids, float *dists, unsigned interleave = 1, bool *truncated = nullptr);
+
+        IndexBuilder *range_search(TYPE entry_type, TYPE route_type, const float *queries, unsigned query_num,
+                                   float radius, unsigned cap, std::vector<std::vector<Index::SimpleNeighbor>> &res);
+
+        IndexBuilder *label_filter(const std::vector<unsigned> &labels, boost::dynamic_bitset<> &filter);
+
+        IndexBuilder *filtered_search(TYPE entry_type, TYPE route_type, const float *queries, unsigned query_num,
+                                      unsigned K, const std::vector<boost::dynamic_bitset<>> &filters, unsigned *ids,
+                                      float *dists);
+
+        IndexBuilder *set_search_budget(unsigned time_us, unsigned dist_num);
+
+        IndexBuilder *enable_query_cache(size_t capacity, float quant_step, unsigned shard_num = 16);
+
+        void query_cache_stats(size_t &exact_hits, size_t &near_hits, size_t &misses) const;
+
+        IndexBuilder *set_early_stop(unsigned patience, float ratio);
+
+        IndexBuilder *sweep(TYPE entry_type, TYPE route_type, unsigned K, const std::vector<unsigned> &L_list,
+                            const std::vector<float> &ec_list, char *result_file, bool incremental = false);
+
+        IndexBuilder *tune(TYPE entry_type, TYPE route_type, unsigned K, float target_recall, unsigned sample_num,
+                           char *graph_file);
+
+        IndexBuilder *load_search_param(char *graph_file);
 
         void print_graph();
 
@@ -46,8 +84,40 @@ namespace weavess {
         std::chrono::duration<double> GetBuildTime() { return e - s; }
 
     private:
+        ComponentSearchEntry *GetSearchEntry(TYPE entry_type);
+
+        ComponentSearchRoute *GetSearchRoute(TYPE route_type);
+
+        void UseSearchComponents(TYPE entry_type, TYPE route_type);
+
+        float GetRecall(std::vector<std::vector<unsigned>> &res, unsigned K);
+
+        unsigned GetHits(unsigned query, const std::vector<unsigned> &res, unsigned K);
+
+        float GetSampleRecall(ComponentSearchEntry *a, ComponentSearchRoute *b, const std::vector<unsigned> &queries,
+                              unsigned K);
+
+        static const char *GetTypeName(TYPE type);
+
+        uint64_t SearchSalt(TYPE entry_type, TYPE route_type);
+
+        void ClearQueryCache();
+
+        bool SearchCached(ComponentSearchEntry *a, ComponentSearchRoute *b, unsigned query, unsigned K, uint64_t salt,
+                          std::vector<Index::Neighbor> &pool, std::vector<unsigned> &seeds, unsigned *ids,
+                          float *dists);
+
         Index *final_index_;
 
+        // 批量搜索复用的组件
+        ComponentSearchEntry *search_entry_ = nullptr;
+        ComponentSearchRoute *search_route_ = nullptr;
+        TYPE search_entry_type_;
+        TYPE search_route_type_;
+
+        // 批量搜索前置的查询结果缓存，未启用时为空
+        Index::QueryCache *query_cache_ = nullptr;
+
         std::chrono::high_resolution_clock::time_point s;
         std::chrono::high_resolution_clock::time_point e;
     };
@@ -13,7 +13,8 @@ namespace weavess {
     public:
         explicit Component(Index *index) : index(index) {}
 
-        virtual ~Component() { delete index; }
+        // index 由 IndexBuilder 持有，组件只借用
+        virtual ~Component() = default;
 
     protected:
         Index *index = nullptr;
@@ -25,6 +26,10 @@ namespace weavess {
         explicit ComponentLoad(Index *index) : Component(index) {}
 
         virtual void LoadInner(char *data_file, char *query_file, char *ground_file, Parameters &parameters);
+
+        virtual void LoadQueryInner(char *query_file, char *ground_file, Parameters &parameters);
+
+        virtual void LoadLabelsInner(char *label_file);
     };
 
 
@@ -34,6 +39,9 @@ namespace weavess {
         explicit ComponentInit(Index *index) : Component(index) {}
 
         virtual void InitInner() = 0;
+
+    protected:
+        void ExactKNNG(unsigned K, std::vector<std::vector<Index::SimpleNeighbor> > &graph);
     };
 
     class ComponentInitRandom : public ComponentInit {
@@ -125,18 +133,16 @@ namespace weavess {
     private:
         void SetConfigs();
 
-        int GetRandomSeedPerThread();
+        void InsertNode(unsigned qnode, Index::VisitedList *visited_list);
 
-        int GetRandomNodeLevel();
+        void SearchAtLayer(unsigned qnode, unsigned enterpoint, Index::VisitedList *visited_list,
+                           std::priority_queue<std::pair<float, unsigned>> &result);
 
-        void InsertNode(Index::HnswNode *qnode, Index::VisitedList *visited_list);
-
-        void SearchAtLayer(Index::HnswNode *qnode, Index::HnswNode *enterpoint, int level,
-                           Index::VisitedList *visited_list, std::priority_queue<Index::FurtherFirst> &result);
-
-        void Link(Index::HnswNode *source, Index::HnswNode *target, int level);
+        void Link(unsigned source, unsigned target);
     };
 
+    class ComponentPrune;
+
     class ComponentInitHNSW : public ComponentInit {
     public:
         explicit ComponentInitHNSW(Index *index) : ComponentInit(index) {}
@@ -152,12 +158,18 @@ namespace weavess {
 
         int GetRandomNodeLevel();
 
-        void InsertNode(Index::HnswNode *qnode, Index::VisitedList *visited_list);
+        unsigned *GetLinks(unsigned id, int level);
 
-        void SearchAtLayer(Index::HnswNode *qnode, Index::HnswNode *enterpoint, int level,
-                           Index::VisitedList *visited_list, std::priority_queue<Index::FurtherFirst> &result);
+        void CopyLinks(unsigned id, int level, std::vector<unsigned> &links);
 
-        void Link(Index::HnswNode *source, Index::HnswNode *target, int level);
+        void InsertNode(unsigned qnode, int level, Index::VisitedList *visited_list);
+
+        void SearchAtLayer(unsigned qnode, unsigned enterpoint, int level, Index::VisitedList *visited_list,
+                           std::vector<Index::SimpleNeighbor> &result);
+
+        void Link(unsigned source, unsigned target, int level);
+
+        std::unique_ptr<ComponentPrune> prune_;
     };
 
     class ComponentInitANNG : public ComponentInit {
@@ -291,8 +303,6 @@ namespace weavess {
 
     private:
         void SetConfigs();
-
-        void init();
     };
 
     class ComponentInitHCNNG : public ComponentInit {
@@ -337,6 +347,17 @@ namespace weavess {
         explicit ComponentRefine(Index *index) : Component(index) {}
 
         virtual void RefineInner() = 0;
+
+    protected:
+        void ReverseLink(unsigned range);
+
+        void CopyPruned(unsigned range, const Index::SimpleNeighbor *des_pool, std::vector<Index::SimpleNeighbor> &row);
+
+        // 反向边合并后超过 range 时的裁剪，pool 按距离升序，保留的邻居写入 result，默认取最近的 range 个
+        virtual void InterInsert(unsigned n, unsigned range, std::vector<Index::SimpleNeighbor> &pool,
+                                 std::vector<Index::SimpleNeighbor> &result) {
+            result.assign(pool.begin(), pool.begin() + std::min<size_t>(range, pool.size()));
+        }
     };
 
     class ComponentRefineNNDescent : public ComponentRefine {
@@ -352,13 +373,13 @@ namespace weavess {
 
         void NNDescent();
 
-        void join();
+        size_t join();
 
         void update();
         
         void generate_control_set(std::vector<unsigned> &c, std::vector<std::vector<unsigned> > &v, unsigned N);
 
-        void eval_recall(std::vector<unsigned> &ctrl_points, std::vector<std::vector<unsigned> > &acc_eval_set);
+        float eval_recall(std::vector<unsigned> &ctrl_points, std::vector<std::vector<unsigned> > &acc_eval_set);
     };
 
     class ComponentRefineNSG : public ComponentRefine {
@@ -368,9 +389,10 @@ namespace weavess {
         void RefineInner() override;
 
     private:
-        void Link(Index::SimpleNeighbor *cut_graph_);
+        void Link();
 
-        void InterInsert(unsigned n, unsigned range, std::vector<std::mutex> &locks, Index::SimpleNeighbor *cut_graph_);
+        void InterInsert(unsigned n, unsigned range, std::vector<Index::SimpleNeighbor> &pool,
+                         std::vector<Index::SimpleNeighbor> &result) override;
 
         void SetConfigs();
     };
@@ -384,10 +406,10 @@ namespace weavess {
     private:
         void SetConfigs();
 
-        void Link(Index::SimpleNeighbor *cut_graph_);
+        void Link();
 
-        void InterInsert(unsigned n, unsigned range, float threshold, std::vector<std::mutex> &locks,
-                         Index::SimpleNeighbor *cut_graph_);
+        void InterInsert(unsigned n, unsigned range, std::vector<Index::SimpleNeighbor> &pool,
+                         std::vector<Index::SimpleNeighbor> &result) override;
     };
 
     class ComponentRefineDPG : public ComponentRefine {
@@ -399,9 +421,7 @@ namespace weavess {
     private:
         void SetConfigs();
 
-        void Link(Index::SimpleNeighbor *cut_graph_);
-
-        void InterInsert(unsigned n, unsigned range, std::vector<std::mutex> &locks, Index::SimpleNeighbor *cut_graph_);
+        void Link();
     };
 
     class ComponentRefineVAMANA : public ComponentRefine {
@@ -413,10 +433,10 @@ namespace weavess {
     private:
         void SetConfigs();
 
-        void Link(Index::SimpleNeighbor *cut_graph_);
+        void Link();
 
-        void InterInsert(unsigned n, unsigned range, std::vector<std::mutex> &locks,
-                         Index::SimpleNeighbor *cut_graph_);
+        void InterInsert(unsigned n, unsigned range, std::vector<Index::SimpleNeighbor> &pool,
+                         std::vector<Index::SimpleNeighbor> &result) override;
     };
 
     class ComponentRefineEFANNA : public ComponentRefine {
@@ -528,7 +548,7 @@ namespace weavess {
     public:
         explicit ComponentCandidate(Index *index) : Component(index) {}
 
-        virtual void CandidateInner(unsigned query, unsigned enter, boost::dynamic_bitset<> flags,
+        virtual void CandidateInner(unsigned query, unsigned enter, Index::BuildScratch &scratch,
                                     std::vector<Index::SimpleNeighbor> &pool) = 0;
     };
 
@@ -536,7 +556,7 @@ namespace weavess {
     public:
         explicit ComponentCandidateNSG(Index *index) : ComponentCandidate(index) {}
 
-        void CandidateInner(unsigned query, unsigned enter, boost::dynamic_bitset<> flags,
+        void CandidateInner(unsigned query, unsigned enter, Index::BuildScratch &scratch,
                             std::vector<Index::SimpleNeighbor> &result) override;
     };
 
@@ -544,7 +564,7 @@ namespace weavess {
     public:
         explicit ComponentCandidatePropagation2(Index *index) : ComponentCandidate(index) {}
 
-        void CandidateInner(const unsigned query, const unsigned enter, boost::dynamic_bitset<> flags,
+        void CandidateInner(const unsigned query, const unsigned enter, Index::BuildScratch &scratch,
                             std::vector<Index::SimpleNeighbor> &pool) override;
     };
 
@@ -552,7 +572,7 @@ namespace weavess {
     public:
         explicit ComponentCandidateSPTAG_KDT(Index *index) : ComponentCandidate(index) {}
 
-        void CandidateInner(unsigned query, unsigned enter, boost::dynamic_bitset<> flags,
+        void CandidateInner(unsigned query, unsigned enter, Index::BuildScratch &scratch,
                             std::vector<Index::SimpleNeighbor> &result) override;
 
     private:
@@ -565,7 +585,7 @@ namespace weavess {
     public:
         explicit ComponentCandidateSPTAG_BKT(Index *index) : ComponentCandidate(index) {}
 
-        void CandidateInner(unsigned query, unsigned enter, boost::dynamic_bitset<> flags,
+        void CandidateInner(unsigned query, unsigned enter, Index::BuildScratch &scratch,
                             std::vector<Index::SimpleNeighbor> &result) override;
 
     private:
@@ -580,36 +600,25 @@ namespace weavess {
     public:
         explicit ComponentPrune(Index *index) : Component(index) {}
 
-        virtual void PruneInner(unsigned query, unsigned range, boost::dynamic_bitset<> flags,
+        // 裁剪 query 的候选，结果写入 des_pool 的 range 个槽位，不足时以 distance == -1 结尾
+        virtual void PruneInner(unsigned query, unsigned range, Index::BuildScratch &scratch,
                                 std::vector<Index::SimpleNeighbor> &pool,
-                                Index::SimpleNeighbor *cut_graph_) = 0;
-
-        void Hnsw2Neighbor(unsigned query, unsigned range, std::priority_queue<Index::FurtherFirst> &result) {
-            int n = result.size();
-            std::vector<Index::SimpleNeighbor> pool(n);
-            std::unordered_map<int, Index::HnswNode *> tmp;
-
-            for (int i = n - 1; i >= 0; i--) {
-                Index::FurtherFirst f = result.top();
-                pool[i] = Index::SimpleNeighbor(f.GetNode()->GetId(), f.GetDistance());
-                tmp[f.GetNode()->GetId()] = f.GetNode();
-                result.pop();
-            }
+                                Index::SimpleNeighbor *des_pool) = 0;
 
-            boost::dynamic_bitset<> flags;
+        // 将按距离升序的候选裁剪为至多 range 个邻居，结果按距离升序写回 pool，只适用于不读取 query 自身的裁边策略
+        void PruneToRange(unsigned range, std::vector<Index::SimpleNeighbor> &pool) {
+            // 不传访问表，候选不会被跳过
+            Index::BuildScratch scratch;
 
-            auto *cut_graph_ = new Index::SimpleNeighbor[range];
+            std::vector<Index::SimpleNeighbor> des_pool(range);
 
-            PruneInner(query, range, flags, pool, cut_graph_);
+            PruneInner(0, range, scratch, pool, des_pool.data());
 
+            pool.clear();
             for (unsigned j = 0; j < range; j++) {
-                if (cut_graph_[j].distance == -1) break;
-
-                result.push(Index::FurtherFirst(tmp[cut_graph_[j].id], cut_graph_[j].distance));
+                if (des_pool[j].distance == -1) break;
+                pool.push_back(des_pool[j]);
             }
-
-            std::vector<Index::SimpleNeighbor>().swap(pool);
-            std::unordered_map<int, Index::HnswNode *>().swap(tmp);
         }
     };
 
@@ -617,56 +626,56 @@ namespace weavess {
     public:
         explicit ComponentPruneNaive(Index *index) : ComponentPrune(index) {}
 
-        void PruneInner(unsigned query, unsigned range, boost::dynamic_bitset<> flags,
-                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) override;
+        void PruneInner(unsigned query, unsigned range, Index::BuildScratch &scratch,
+                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) override;
     };
 
     class ComponentPruneNSG : public ComponentPrune {
     public:
         explicit ComponentPruneNSG(Index *index) : ComponentPrune(index) {}
 
-        void PruneInner(unsigned q, unsigned range, boost::dynamic_bitset<> flags,
-                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) override;
+        void PruneInner(unsigned q, unsigned range, Index::BuildScratch &scratch,
+                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) override;
     };
 
     class ComponentPruneSSG : public ComponentPrune {
     public:
         explicit ComponentPruneSSG(Index *index) : ComponentPrune(index) {}
 
-        void PruneInner(unsigned q, unsigned range, boost::dynamic_bitset<> flags,
-                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) override;
+        void PruneInner(unsigned q, unsigned range, Index::BuildScratch &scratch,
+                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) override;
     };
 
     class ComponentPruneDPG : public ComponentPrune {
     public:
         explicit ComponentPruneDPG(Index *index) : ComponentPrune(index) {}
 
-        void PruneInner(unsigned q, unsigned range, boost::dynamic_bitset<> flags,
-                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) override;
+        void PruneInner(unsigned q, unsigned range, Index::BuildScratch &scratch,
+                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) override;
     };
 
     class ComponentPruneVAMANA : public ComponentPrune {
     public:
         explicit ComponentPruneVAMANA(Index *index) : ComponentPrune(index) {}
 
-        void PruneInner(unsigned q, unsigned range, boost::dynamic_bitset<> flags,
-                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) override;
+        void PruneInner(unsigned q, unsigned range, Index::BuildScratch &scratch,
+                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) override;
     };
 
     class ComponentPruneHeuristic : public ComponentPrune {
     public:
         explicit ComponentPruneHeuristic(Index *index) : ComponentPrune(index) {}
 
-        void PruneInner(unsigned q, unsigned range, boost::dynamic_bitset<> flags,
-                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) override;
+        void PruneInner(unsigned q, unsigned range, Index::BuildScratch &scratch,
+                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) override;
     };
 
     class ComponentPruneRNG : public ComponentPrune {
     public:
         explicit ComponentPruneRNG(Index *index) : ComponentPrune(index) {}
 
-        void PruneInner(unsigned q, unsigned range, boost::dynamic_bitset<> flags,
-                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) override;
+        void PruneInner(unsigned q, unsigned range, Index::BuildScratch &scratch,
+                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) override;
     };
 
 
@@ -676,6 +685,14 @@ namespace weavess {
         explicit ComponentConn(Index *index) : Component(index) {}
 
         virtual void ConnInner() = 0;
+
+    protected:
+        void Reach(const std::vector<unsigned> &roots, Index::AtomicVisitedList &visited);
+
+        void Unreached(Index::AtomicVisitedList &visited, std::vector<unsigned> &unreached);
+
+        void CoverRoots(const std::vector<unsigned> &unreached, Index::AtomicVisitedList &visited,
+                        std::vector<unsigned> &roots, std::vector<unsigned> *covered = nullptr);
     };
 
     class ComponentConnNSGDFS : ComponentConn {
@@ -687,12 +704,8 @@ namespace weavess {
     private:
         void tree_grow();
 
-        void DFS(boost::dynamic_bitset<> &flag, unsigned root, unsigned &cnt);
-
-        void findroot(boost::dynamic_bitset<> &flag, unsigned &root);
-
-        void
-        get_neighbors(const float *query, std::vector<Index::Neighbor> &retset, std::vector<Index::Neighbor> &fullset);
+        void get_neighbors(const float *query, Index::BuildScratch &scratch, std::vector<Index::Neighbor> &retset,
+                           std::vector<Index::Neighbor> &fullset);
     };
 
     class ComponentConnSSGDFS : ComponentConn {
@@ -790,44 +803,132 @@ namespace weavess {
     public:
         explicit ComponentSearchRoute(Index *index) : Component(index) {}
 
-        virtual void RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) = 0;
+        // 结果按距离升序写入 ids/dists（各 K_search 个），不足时保留调用方的初始值；因搜索预算耗尽提前返回时结果为 true
+        virtual bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) = 0;
+
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) {
+            const auto K = index->getParam().get<unsigned>("K_search");
+            res.assign(K, -1);
+            std::vector<float> dists(K, std::numeric_limits<float>::max());
+
+            bool truncated = RouteInner(query, pool, res.data(), dists.data());
+
+            res.erase(std::find(res.begin(), res.end(), (unsigned) -1), res.end());
+            return truncated;
+        }
+
+        /**
+         * 一组查询（query_begin 起连续 num 个）交错执行，第 i 个查询的结果写入 ids/dists 的第 i 行（每行 K_search 个）。
+         * 默认逐个执行，支持的路由用无栈协程交错各查询以隐藏访存延迟
+         * @param pools 各查询入口点组件给出的候选池
+         * @param truncated 各查询是否因搜索预算耗尽而提前返回
+         */
+        virtual void RouteInterleaved(unsigned query_begin, unsigned num,
+                                      std::vector<std::vector<Index::Neighbor>> &pools, unsigned *ids, float *dists,
+                                      bool *truncated) {
+            const auto K = index->getParam().get<unsigned>("K_search");
+            for (unsigned i = 0; i < num; i++) {
+                truncated[i] = RouteInner(query_begin + i, pools[i], ids + (size_t) i * K, dists + (size_t) i * K);
+            }
+        }
+
+        // 是否从入口点组件给出的候选池出发；为 false 的路由自带入口，外部加入候选池的种子不起作用
+        virtual bool ReadsPool() const { return true; }
+
+        void RangeSearch(unsigned query, std::vector<Index::Neighbor> &pool, float radius, unsigned cap,
+                         std::vector<Index::SimpleNeighbor> &res);
+
+        void FilteredSearch(unsigned query, std::vector<Index::Neighbor> &pool, const boost::dynamic_bitset<> &filter,
+                            size_t match_num, unsigned *ids, float *dists);
+
+    protected:
+        // 带过滤的路由：遍历经过不满足条件的点，只有满足条件的点计入结果；默认对满足条件的点暴力搜索
+        virtual void RouteFiltered(unsigned query, std::vector<Index::Neighbor> &pool,
+                                   const boost::dynamic_bitset<> &filter, unsigned *ids, float *dists);
+
+        void BruteForceFiltered(unsigned query, const boost::dynamic_bitset<> &filter, unsigned *ids, float *dists);
+
+        // 范围搜索扩展时使用的邻接表，默认取 load_graph 载入的图，否则取构建结果
+        virtual void GetNeighbors(unsigned id, std::vector<unsigned> &neighbors);
+
+        // 按 search_time_budget_us、search_dist_budget 参数创建单个查询的搜索预算，未设置时不限
+        Index::SearchBudget GetBudget() const {
+            return Index::SearchBudget(index->getParam().get<unsigned>("search_time_budget_us", 0),
+                                       index->getParam().get<unsigned>("search_dist_budget", 0));
+        }
     };
 
     class ComponentSearchRouteGreedy : public ComponentSearchRoute {
     public:
         explicit ComponentSearchRouteGreedy(Index *index) : ComponentSearchRoute(index) {}
 
-        void RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) override;
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
+
+        void RouteInterleaved(unsigned query_begin, unsigned num, std::vector<std::vector<Index::Neighbor>> &pools,
+                              unsigned *ids, float *dists, bool *truncated) override;
+
+        void InitState(std::vector<Index::Neighbor> &pool, Index::SearchState &state);
+
+        void RouteResume(unsigned query, unsigned L, Index::SearchState &state, std::vector<unsigned> &res);
+
+    protected:
+        void RouteFiltered(unsigned query, std::vector<Index::Neighbor> &pool, const boost::dynamic_bitset<> &filter,
+                           unsigned *ids, float *dists) override;
+
+    private:
+        // 按 early_stop_patience、early_stop_ratio 参数创建自适应终止条件，未设置时不启用
+        Index::EarlyStop GetEarlyStop(unsigned K) const {
+            return Index::EarlyStop(K, index->getParam().get<unsigned>("early_stop_patience", 0),
+                                    index->getParam().get<float>("early_stop_ratio", 0));
+        }
     };
 
     class ComponentSearchRouteNSW : public ComponentSearchRoute {
     public:
         explicit ComponentSearchRouteNSW(Index *index) : ComponentSearchRoute(index) {}
 
-        void RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) override;
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
+
+        bool ReadsPool() const override { return false; }
+
+    protected:
+        void GetNeighbors(unsigned id, std::vector<unsigned> &neighbors) override;
 
     private:
-        void SearchAtLayer(unsigned qnode, Index::HnswNode *enterpoint, int level,
-                           Index::VisitedList *visited_list,
-                           std::priority_queue<Index::FurtherFirst> &result);
+        void SearchAtLayer(unsigned qnode, unsigned enterpoint, Index::VisitedList *visited_list,
+                           Index::SearchBudget &budget, std::priority_queue<std::pair<float, unsigned>> &result);
     };
 
     class ComponentSearchRouteHNSW : public ComponentSearchRoute {
     public:
         explicit ComponentSearchRouteHNSW(Index *index) : ComponentSearchRoute(index) {}
 
-        void RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) override;
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
+
+        bool ReadsPool() const override { return false; }
+
+        void RouteInterleaved(unsigned query_begin, unsigned num, std::vector<std::vector<Index::Neighbor>> &pools,
+                              unsigned *ids, float *dists, bool *truncated) override;
+
+    protected:
+        void GetNeighbors(unsigned id, std::vector<unsigned> &neighbors) override;
+
+        void RouteFiltered(unsigned query, std::vector<Index::Neighbor> &pool, const boost::dynamic_bitset<> &filter,
+                           unsigned *ids, float *dists) override;
 
     private:
-        void SearchById_(unsigned query, Index::HnswNode* cur_node, float cur_dist, size_t k,
-                         size_t ef_search, std::vector<std::pair<Index::HnswNode*, float>> &result);
+        unsigned SearchUpperLayers(const float *query, float &dist);
+
+        void SearchAtLayer0(const float *query, unsigned enterpoint, float enter_dist, unsigned ef,
+                            Index::VisitedList *visited_list, Index::SearchBudget &budget,
+                            std::priority_queue<std::pair<float, unsigned>> &result);
     };
 
     class ComponentSearchRouteIEH : public ComponentSearchRoute {
     public:
         explicit ComponentSearchRouteIEH(Index *index) : ComponentSearchRoute(index) {}
 
-        void RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) override;
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
 
     private:
         void HashTest(int upbits, int lowbits, Index::Codes querycode, Index::HashTable tb,
@@ -838,14 +939,16 @@ namespace weavess {
     public:
         explicit ComponentSearchRouteBacktrack(Index *index) : ComponentSearchRoute(index) {}
 
-        void RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) override;
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
     };
 
     class ComponentSearchRouteSPTAG_KDT : public ComponentSearchRoute {
     public:
         explicit ComponentSearchRouteSPTAG_KDT(Index *index) : ComponentSearchRoute(index) {}
 
-        void RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) override;
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
+
+        bool ReadsPool() const override { return false; }
 
     private:
         void KDTSearch(unsigned query, int node, Index::Heap &m_NGQueue, Index::Heap &m_SPTQueue,
@@ -857,7 +960,9 @@ namespace weavess {
     public:
         explicit ComponentSearchRouteSPTAG_BKT(Index *index) : ComponentSearchRoute(index) {}
 
-        void RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) override;
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
+
+        bool ReadsPool() const override { return false; }
 
     private:
         void BKTSearch(unsigned int query, Index::Heap &m_NGQueue,
@@ -867,18 +972,37 @@ namespace weavess {
                   int p_limits);
     };
 
+    class ComponentSearchRouteBeam : public ComponentSearchRoute {
+    public:
+        explicit ComponentSearchRouteBeam(Index *index) : ComponentSearchRoute(index) {}
+
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
+    };
+
+    class ComponentSearchRouteDisk : public ComponentSearchRoute {
+    public:
+        explicit ComponentSearchRouteDisk(Index *index) : ComponentSearchRoute(index) {}
+
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
+
+        bool ReadsPool() const override { return false; }
+
+    private:
+        void ReadNodes(const std::vector<unsigned> &nodes, char *buffer);
+    };
+
     class ComponentSearchRouteGuided : public ComponentSearchRoute {
     public:
         explicit ComponentSearchRouteGuided(Index *index) : ComponentSearchRoute(index) {}
 
-        void RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) override;
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
     };
 
     class ComponentSearchRouteNGT : public ComponentSearchRoute {
     public:
         explicit ComponentSearchRouteNGT(Index *index) : ComponentSearchRoute(index) {}
 
-        void RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &res) override;
+        bool RouteInner(unsigned query, std::vector<Index::Neighbor> &pool, unsigned *ids, float *dists) override;
     };
 }
 
@@ -5,6 +5,10 @@
 #ifndef WEAVESS_DISTANCE_H
 #define WEAVESS_DISTANCE_H
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace weavess {
     class Distance {
     public:
@@ -34,6 +38,54 @@ namespace weavess {
 
             return result;
         }
+
+        /**
+         * a 与 num 个连续存放的向量逐一求距离，每次同时计算 4 个向量，a 的每段只载入一次。
+         * 累加顺序与 compare 相同，结果与逐个调用 compare 逐位一致
+         * @param a 向量
+         * @param block num * length 的连续向量
+         * @param num 向量个数
+         * @param length 维度
+         * @param dists 输出 num 个距离
+         */
+        void compare_block(const float *a, const float *block, unsigned num, unsigned length, float *dists) const {
+            unsigned i = 0;
+#ifdef __SSE2__
+            const unsigned body = length & ~3u;
+            for (; i + 4 <= num; i += 4) {
+                const float *b0 = block + (size_t) i * length;
+                const float *b1 = b0 + length;
+                const float *b2 = b1 + length;
+                const float *b3 = b2 + length;
+                __m128 sum = _mm_setzero_ps();
+                for (unsigned k = 0; k < body; k += 4) {
+                    __m128 va = _mm_loadu_ps(a + k);
+                    __m128 d0 = _mm_sub_ps(va, _mm_loadu_ps(b0 + k));
+                    __m128 d1 = _mm_sub_ps(va, _mm_loadu_ps(b1 + k));
+                    __m128 d2 = _mm_sub_ps(va, _mm_loadu_ps(b2 + k));
+                    __m128 d3 = _mm_sub_ps(va, _mm_loadu_ps(b3 + k));
+                    d0 = _mm_mul_ps(d0, d0);
+                    d1 = _mm_mul_ps(d1, d1);
+                    d2 = _mm_mul_ps(d2, d2);
+                    d3 = _mm_mul_ps(d3, d3);
+                    // 4x4 转置后第 j 个分量属于第 j 个向量，与 compare 一样先按维度顺序求组内和再累加
+                    _MM_TRANSPOSE4_PS(d0, d1, d2, d3);
+                    sum = _mm_add_ps(sum, _mm_add_ps(_mm_add_ps(_mm_add_ps(d0, d1), d2), d3));
+                }
+                _mm_storeu_ps(dists + i, sum);
+                for (unsigned k = body; k < length; k++) {
+                    float t0 = a[k] - b0[k], t1 = a[k] - b1[k], t2 = a[k] - b2[k], t3 = a[k] - b3[k];
+                    dists[i] += t0 * t0;
+                    dists[i + 1] += t1 * t1;
+                    dists[i + 2] += t2 * t2;
+                    dists[i + 3] += t3 * t3;
+                }
+            }
+#endif
+            for (; i < num; i++) {
+                dists[i] = compare(a, block + (size_t) i * length, length);
+            }
+        }
     };
 }
 
@@ -28,7 +28,10 @@
 #define NGT_SEED_SIZE 5
 
 #include <omp.h>
+#include <list>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <queue>
 #include <stack>
 #include <thread>
@@ -36,10 +39,12 @@
 #include <chrono>
 #include <cstring>
 #include <cfloat>
+#include <cmath>
 #include <fstream>
 #include <cassert>
 #include <iostream>
 #include <algorithm>
+#include <unordered_map>
 #include <unordered_set>
 #include <boost/dynamic_bitset.hpp>
 #include <boost/shared_ptr.hpp>
@@ -51,9 +56,38 @@
 #include "CommonDataStructure.h"
 #include <mm_malloc.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace weavess {
 
+    // 条带锁：结点按 id 映射到固定数量的互斥锁，代替每个结点一把锁，条带数为 2 的幂
+    class StripedLocks {
+    public:
+        explicit StripedLocks(size_t stripes = 0) : locks_(stripes) {}
+
+        void resize(size_t stripes) {
+            std::vector<std::mutex>(stripes).swap(locks_);
+        }
+
+        inline std::mutex &operator[](size_t id) {
+            return locks_[id & (locks_.size() - 1)];
+        }
+
+        // 条带数取线程数的 1024 倍向上取整到 2 的幂，内存与冲突概率只随线程数变化，与结点数无关
+        static size_t StripesForThreads(unsigned threads) {
+            size_t stripes = 1;
+            while (stripes < (size_t) std::max(threads, 1u) * 1024) stripes <<= 1;
+            return stripes;
+        }
+
+    private:
+        std::vector<std::mutex> locks_;
+    };
+
     class NNDescent {
     public:
         unsigned K;
@@ -61,6 +95,8 @@ namespace weavess {
         unsigned R;
         unsigned L;
         unsigned ITER;
+        float delta;            // 单轮候选池更新数低于 delta * N * L 时提前结束迭代
+        unsigned recall_sample; // 每轮估计图质量的采样点数，0 表示不估计
 
         struct Neighbor {
             unsigned id;
@@ -83,7 +119,6 @@ namespace weavess {
         typedef std::lock_guard<std::mutex> LockGuard;
 
         struct nhood {
-            std::mutex lock;
             std::vector<Neighbor> pool;
             unsigned M;
 
@@ -116,9 +151,8 @@ namespace weavess {
                 pool.reserve(other.pool.capacity());
             }
 
-            // 插入大顶堆
+            // 插入大顶堆，调用方需持有该结点的条带锁 nhood_locks_
             void insert(unsigned id, float dist) {
-                LockGuard guard(lock);
                 if (dist > pool.front().distance) return;
                 for (unsigned i = 0; i < pool.size(); i++) {
                     if (id == pool[i].id)return;
@@ -149,6 +183,110 @@ namespace weavess {
             }
         };
 
+        /**
+         * NN-Descent 的扁平状态：各结点的候选池（大顶堆）、新旧邻居与反向邻居按结点定长分段存放在连续数组中，
+         * 迭代间只改写各段长度，不再分配内存
+         */
+        struct FlatGraph {
+            unsigned pool_cap = 0;
+            unsigned nn_cap = 0;
+            unsigned rnn_cap = 0;
+
+            std::vector<Neighbor> pools;
+            std::vector<unsigned> pool_size;
+            std::vector<unsigned> M;
+
+            std::vector<unsigned> nn_new;
+            std::vector<unsigned> nn_new_size;
+            std::vector<unsigned> nn_old;
+            std::vector<unsigned> nn_old_size;
+            std::vector<unsigned> rnn_new;
+            std::vector<unsigned> rnn_new_size;
+            std::vector<unsigned> rnn_old;
+            std::vector<unsigned> rnn_old_size;
+
+            /**
+             * @param n 结点数
+             * @param pool_capacity 候选池容量 L
+             * @param sample 每轮新邻居采样数 S
+             * @param reverse 反向邻居上限 R
+             */
+            void init(unsigned n, unsigned pool_capacity, unsigned sample, unsigned reverse) {
+                pool_cap = pool_capacity;
+                nn_cap = pool_capacity + reverse;
+                rnn_cap = reverse;
+                pools.assign((size_t) n * pool_cap, Neighbor());
+                pool_size.assign(n, 0);
+                M.assign(n, sample);
+                nn_new.assign((size_t) n * nn_cap, 0);
+                nn_new_size.assign(n, 0);
+                nn_old.assign((size_t) n * nn_cap, 0);
+                nn_old_size.assign(n, 0);
+                rnn_new.assign((size_t) n * rnn_cap, 0);
+                rnn_new_size.assign(n, 0);
+                rnn_old.assign((size_t) n * rnn_cap, 0);
+                rnn_old_size.assign(n, 0);
+            }
+
+            void clear() {
+                FlatGraph().swap(*this);
+            }
+
+            void swap(FlatGraph &other) {
+                std::swap(pool_cap, other.pool_cap);
+                std::swap(nn_cap, other.nn_cap);
+                std::swap(rnn_cap, other.rnn_cap);
+                pools.swap(other.pools);
+                pool_size.swap(other.pool_size);
+                M.swap(other.M);
+                nn_new.swap(other.nn_new);
+                nn_new_size.swap(other.nn_new_size);
+                nn_old.swap(other.nn_old);
+                nn_old_size.swap(other.nn_old_size);
+                rnn_new.swap(other.rnn_new);
+                rnn_new_size.swap(other.rnn_new_size);
+                rnn_old.swap(other.rnn_old);
+                rnn_old_size.swap(other.rnn_old_size);
+            }
+
+            inline Neighbor *pool(unsigned n) { return pools.data() + (size_t) n * pool_cap; }
+
+            inline unsigned *new_list(unsigned n) { return nn_new.data() + (size_t) n * nn_cap; }
+
+            inline unsigned *old_list(unsigned n) { return nn_old.data() + (size_t) n * nn_cap; }
+
+            inline unsigned *reverse_new(unsigned n) { return rnn_new.data() + (size_t) n * rnn_cap; }
+
+            inline unsigned *reverse_old(unsigned n) { return rnn_old.data() + (size_t) n * rnn_cap; }
+
+            // 插入结点 n 的大顶堆，返回候选池是否被更新；调用方需持有该结点的条带锁 nhood_locks_
+            bool insert(unsigned n, unsigned id, float dist) {
+                Neighbor *heap = pool(n);
+                unsigned &size = pool_size[n];
+                if (size > 0 && dist > heap[0].distance) return false;
+                for (unsigned i = 0; i < size; i++) {
+                    if (id == heap[i].id) return false;
+                }
+                if (size < pool_cap) {
+                    heap[size++] = Neighbor(id, dist, true);
+                    std::push_heap(heap, heap + size);
+                } else {
+                    std::pop_heap(heap, heap + size);
+                    heap[size - 1] = Neighbor(id, dist, true);
+                    std::push_heap(heap, heap + size);
+                }
+                return true;
+            }
+
+            // 采样到的反向邻居，满 rnn_cap 后随机替换，调用方需持有该结点的条带锁
+            template<typename RNG>
+            static void push_reverse(unsigned *list, unsigned &size, unsigned cap, unsigned id, RNG &rng) {
+                if (cap == 0) return;
+                if (size < cap) list[size++] = id;
+                else list[rng() % cap] = id;
+            }
+        };
+
         static inline int InsertIntoPool(Neighbor *addr, unsigned K, Neighbor nn) {
             // find the location to insert
             int left = 0, right = K - 1;
@@ -181,6 +319,9 @@ namespace weavess {
 
         typedef std::vector<nhood> KNNGraph;
         KNNGraph graph_;
+        FlatGraph flat_graph_;
+        // graph_ 各结点的条带锁，使用前由组件按配置的线程数设置条带数
+        StripedLocks nhood_locks_;
     };
 
     class NSG {
@@ -323,6 +464,9 @@ namespace weavess {
         unsigned NN_ ;
         unsigned ef_construction_ = 150;    //l
         unsigned n_threads_ = 1;
+
+        // 各结点邻居 id（按 id 升序），反向边不裁剪，度数不定长
+        std::vector<std::vector<unsigned>> nsw_links_;
     };
 
     class HNSW {
@@ -480,12 +624,45 @@ namespace weavess {
 
             inline unsigned int GetVisitMark() { return mark_; }
 
+            inline unsigned int GetSize() const { return size_; }
+
         private:
             unsigned int *visited_;
             unsigned int size_;
             unsigned int mark_;
         };
 
+        // 可由多个线程同时标记的访问表，TryVisit 仅对首个标记者返回 true
+        class AtomicVisitedList {
+        public:
+            explicit AtomicVisitedList(unsigned size) : size_(size), mark_(1), visited_(new std::atomic<unsigned>[size]) {
+                for (unsigned i = 0; i < size_; i++) visited_[i].store(0, std::memory_order_relaxed);
+            }
+
+            inline bool TryVisit(unsigned index) {
+                if (visited_[index].load(std::memory_order_relaxed) == mark_) return false;
+                return visited_[index].exchange(mark_, std::memory_order_relaxed) != mark_;
+            }
+
+            inline bool Visited(unsigned index) const {
+                return visited_[index].load(std::memory_order_relaxed) == mark_;
+            }
+
+            inline void Reset() {
+                if (++mark_ == 0) {
+                    mark_ = 1;
+                    for (unsigned i = 0; i < size_; i++) visited_[i].store(0, std::memory_order_relaxed);
+                }
+            }
+
+            inline unsigned int GetSize() const { return size_; }
+
+        private:
+            unsigned int size_;
+            unsigned int mark_;
+            std::unique_ptr<std::atomic<unsigned>[]> visited_;
+        };
+
         typedef typename std::pair<HnswNode*, float> IdDistancePair;
         struct IdDistancePairMinHeapComparer {
             bool operator()(const IdDistancePair& p1, const IdDistancePair& p2) const {
@@ -496,6 +673,26 @@ namespace weavess {
 
         HnswNode* enterpoint_ = nullptr;
         std::vector<HnswNode*> nodes_;
+
+        // 分层邻接表，每段首位为邻居数。构建前按各结点层数一次性分配，构建时由 link_locks_ 保护，
+        // 构建完成后只读，搜索时无需加锁
+        // 第 0 层：结点 i 位于 level0_links_[i * (frozen_m0_ + 1)]
+        // 上层：结点 i 的第 l 层位于 upper_links_[upper_offset_[i] + (l - 1) * (frozen_m_ + 1)]
+        std::vector<unsigned> level0_links_;
+        std::vector<unsigned> upper_links_;
+        std::vector<size_t> upper_offset_;
+        unsigned frozen_m0_ = 0;
+        unsigned frozen_m_ = 0;
+        unsigned frozen_enterpoint_ = 0;
+        StripedLocks link_locks_;
+
+        inline const unsigned *GetLevel0Links(unsigned id) const {
+            return level0_links_.data() + (size_t) id * (frozen_m0_ + 1);
+        }
+
+        inline const unsigned *GetUpperLinks(unsigned id, int level) const {
+            return upper_links_.data() + upper_offset_[id] + (size_t) (level - 1) * (frozen_m_ + 1);
+        }
     };
 
     class NGT {
@@ -1567,8 +1764,44 @@ namespace weavess {
         unsigned num_cl = 0;
     };
 
+    class DISK {
+    public:
+        ~DISK() {
+            if (disk_fd_ >= 0) close(disk_fd_);
+        }
+
+        static const unsigned DISK_SECTOR_LEN = 4096;
+
+        // 每个读取单元包含的结点数：结点不跨扇区，不足一个扇区的结点按扇区打包，否则独占整数个扇区
+        unsigned DiskNodesPerBlock() const {
+            return disk_node_size_ <= DISK_SECTOR_LEN ? DISK_SECTOR_LEN / disk_node_size_ : 1;
+        }
+
+        size_t DiskBlockSize() const {
+            return (disk_node_size_ + DISK_SECTOR_LEN - 1) / DISK_SECTOR_LEN * DISK_SECTOR_LEN;
+        }
+
+        // 结点块在磁盘文件中的偏移，块内依次为 原始向量、出度、disk_max_degree_ 个邻居 id
+        size_t DiskNodeOffset(unsigned id) const {
+            const unsigned per_block = DiskNodesPerBlock();
+            return disk_nodes_offset_ + (size_t) (id / per_block) * DiskBlockSize()
+                   + (size_t) (id % per_block) * disk_node_size_;
+        }
+
+        int disk_fd_ = -1;
+        unsigned disk_max_degree_ = 0;
+        unsigned disk_entry_ = 0;
+        unsigned disk_node_size_ = 0;
+        size_t disk_nodes_offset_ = 0;
+
+        // 常驻内存的 SQ8 压缩向量，第 d 维 x ≈ disk_min_[d] + code * disk_scale_[d]
+        std::vector<uint8_t> disk_codes_;
+        std::vector<float> disk_min_;
+        std::vector<float> disk_scale_;
+    };
+
     class Index : public NNDescent, public NSG, public SSG, public DPG, public VAMANA, public EFANNA, public IEH,
-            public NSW, public HNSW, public NGT, public SPTAG, public FANNG, public HCNNG {
+            public NSW, public HNSW, public NGT, public SPTAG, public FANNG, public HCNNG, public DISK {
     public:
         explicit Index() {
             dist_ = new Distance();
@@ -1590,6 +1823,379 @@ namespace weavess {
             }
         };
 
+        /**
+         * 定容候选池：按距离升序保存至多 capacity 个候选，每个候选 8 字节（距离 + id，id 最高位为已扩展标记）。
+         * 插入为无分支二分定位 + 整块平移，下一个未扩展候选由游标维护，前移时用 SSE2 成块检查标记位
+         */
+        class CandidatePool {
+        public:
+            CandidatePool() = default;
+
+            explicit CandidatePool(unsigned capacity) {
+                reset(capacity);
+            }
+
+            // 清空并设置容量
+            void reset(unsigned capacity) {
+                data_.resize(capacity + 1);
+                capacity_ = capacity;
+                size_ = 0;
+                cur_ = 0;
+            }
+
+            // 扩容，保留已有候选
+            void grow(unsigned capacity) {
+                if (capacity <= capacity_) return;
+                data_.resize(capacity + 1);
+                capacity_ = capacity;
+            }
+
+            unsigned size() const { return size_; }
+
+            unsigned capacity() const { return capacity_; }
+
+            bool full() const { return size_ == capacity_; }
+
+            unsigned id(unsigned i) const { return data_[i].id & ~EXPANDED; }
+
+            float distance(unsigned i) const { return data_[i].distance; }
+
+            bool expanded(unsigned i) const { return (data_[i].id & EXPANDED) != 0; }
+
+            // 池满时新候选需优于该距离才能进入；容量为 0 时拒绝所有候选
+            float bound() const {
+                if (!full()) return FLT_MAX;
+                return size_ == 0 ? -FLT_MAX : data_[size_ - 1].distance;
+            }
+
+            /**
+             * 插入候选，池满时挤出池尾
+             * @return 插入位置；未插入（不优于池尾或 id 重复）时返回 capacity
+             */
+            unsigned insert(unsigned id, float distance, bool expanded = false) {
+                if (distance >= bound()) return capacity_;
+
+                // 第一个距离大于 distance 的位置
+                const Candidate *base = data_.data();
+                unsigned n = size_;
+                while (n > 1) {
+                    unsigned half = n / 2;
+                    base = (base[half].distance <= distance) ? base + half : base;
+                    n -= half;
+                }
+                unsigned pos = (unsigned) (base - data_.data()) + (size_ > 0 && base->distance <= distance);
+
+                for (unsigned i = pos; i > 0 && data_[i - 1].distance == distance; i--) {
+                    if ((data_[i - 1].id & ~EXPANDED) == id) return capacity_;
+                }
+
+                unsigned move = (full() ? size_ - 1 : size_) - pos;
+                memmove(&data_[pos + 1], &data_[pos], move * sizeof(Candidate));
+                data_[pos].distance = distance;
+                data_[pos].id = expanded ? (id | EXPANDED) : id;
+                if (!full()) size_++;
+                if (pos < cur_ && !expanded) cur_ = pos;
+                return pos;
+            }
+
+            bool has_unexpanded() {
+                advance();
+                return cur_ < size_;
+            }
+
+            // 最近的未扩展候选的位置，调用前需 has_unexpanded()
+            unsigned next() const { return cur_; }
+
+            // 取出最近的未扩展候选并标记为已扩展，调用前需 has_unexpanded()
+            unsigned pop() {
+                data_[cur_].id |= EXPANDED;
+                return data_[cur_++].id & ~EXPANDED;
+            }
+
+        private:
+            struct Candidate {
+                float distance;
+                unsigned id;
+            };
+
+            static const unsigned EXPANDED = 0x80000000u;
+
+            // 游标移到第一个未扩展候选
+            void advance() {
+#ifdef __SSE2__
+                // 每次取 4 个候选，标记位位于奇数 lane 的符号位
+                while (cur_ + 4 <= size_) {
+                    __m128 lo = _mm_loadu_ps(&data_[cur_].distance);
+                    __m128 hi = _mm_loadu_ps(&data_[cur_ + 2].distance);
+                    int open = ~(_mm_movemask_ps(lo) | (_mm_movemask_ps(hi) << 4)) & 0xAA;
+                    if (open) {
+                        cur_ += __builtin_ctz(open) >> 1;
+                        return;
+                    }
+                    cur_ += 4;
+                }
+#endif
+                while (cur_ < size_ && (data_[cur_].id & EXPANDED)) cur_++;
+            }
+
+            std::vector<Candidate> data_;
+            unsigned capacity_ = 0;
+            unsigned size_ = 0;
+            unsigned cur_ = 0;
+        };
+
+        /**
+         * 贪婪搜索的自适应终止：前 K 个结果连续 patience 次扩展未变化，或最近的未扩展候选距离超过第 K 个结果的 ratio 倍
+         * （距离为 L2 平方，ratio 相应取平方）时停止，参数为 0 时不启用对应条件
+         */
+        class EarlyStop {
+        public:
+            EarlyStop() = default;
+
+            EarlyStop(unsigned K, unsigned patience, float ratio) : K_(K), patience_(patience), ratio_(ratio) {}
+
+            // 扩展前调用，需 pool.has_unexpanded()
+            bool stop(const CandidatePool &pool) const {
+                if (K_ == 0 || pool.size() < K_) return false;
+                if (patience_ != 0 && stable_ >= patience_) return true;
+                return ratio_ > 0 && pool.distance(pool.next()) > ratio_ * pool.distance(K_ - 1);
+            }
+
+            // 扩展后调用，changed 为本次扩展是否改变了前 K 个结果
+            void update(bool changed) {
+                stable_ = changed ? 0 : stable_ + 1;
+            }
+
+        private:
+            unsigned K_ = 0;
+            unsigned patience_ = 0;
+            float ratio_ = 0;
+            unsigned stable_ = 0;
+        };
+
+        /**
+         * 单个查询的搜索预算：耗时（微秒）与距离计算次数上限，0 表示不限。
+         * 路由每次扩展前检查，耗尽后以当前最优结果返回并标记为截断
+         */
+        class SearchBudget {
+        public:
+            SearchBudget() = default;
+
+            SearchBudget(unsigned time_us, unsigned dist_num) : time_us_(time_us), dist_num_(dist_num) {
+                if (time_us_ != 0) deadline_ = std::chrono::steady_clock::now() + std::chrono::microseconds(time_us_);
+            }
+
+            // 已计算 dist_count 次距离时预算是否耗尽，耗尽后保持截断状态
+            bool exhausted(unsigned dist_count) {
+                if (!truncated_) {
+                    truncated_ = (dist_num_ != 0 && dist_count >= dist_num_)
+                                 || (time_us_ != 0 && std::chrono::steady_clock::now() >= deadline_);
+                }
+                return truncated_;
+            }
+
+            bool truncated() const { return truncated_; }
+
+        private:
+            unsigned time_us_ = 0;
+            unsigned dist_num_ = 0;
+            std::chrono::steady_clock::time_point deadline_;
+            bool truncated_ = false;
+        };
+
+        /**
+         * 查询结果缓存：按量化查询向量的哈希分片的 LRU。查询向量完全相同时直接返回缓存的结果，
+         * 量化后落在同一格（近似重复）时给出缓存结果作为候选池种子。各分片独立加锁，可并发访问
+         */
+        class QueryCache {
+        public:
+            enum Result { MISS, NEAR, EXACT };
+
+            /**
+             * @param capacity 总条目数
+             * @param step 量化步长，各维按 floor(x / step) 取格；不大于 0 时只命中完全相同的查询
+             * @param shard_num 分片数
+             */
+            QueryCache(size_t capacity, float step, unsigned shard_num)
+                    : step_(step), exact_hits_(0), near_hits_(0), misses_(0) {
+                shard_num = std::max(1u, shard_num);
+                shard_capacity_ = std::max((size_t) 1, capacity / shard_num);
+                for (unsigned i = 0; i < shard_num; i++) shards_.emplace_back(new Shard());
+            }
+
+            /**
+             * 查找查询的缓存结果
+             * @param salt 参与哈希的搜索配置，配置不同的结果互不命中
+             * @param ids EXACT 时写入前 K 个结果 id
+             * @param dists EXACT 时写入前 K 个结果距离
+             * @param seeds NEAR 时为缓存的结果 id
+             * @param allow_near 为 false 时近似命中按未命中处理，供不从候选池出发的路由使用
+             */
+            Result lookup(const float *query, unsigned dim, uint64_t salt, unsigned K, unsigned *ids, float *dists,
+                          std::vector<unsigned> &seeds, bool allow_near = true) {
+                const uint64_t key = Key(query, dim, salt);
+                Shard &shard = *shards_[key % shards_.size()];
+                std::lock_guard<std::mutex> guard(shard.lock);
+                auto it = shard.map.find(key);
+                if (it == shard.map.end()) {
+                    misses_++;
+                    return MISS;
+                }
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                const Entry &entry = *it->second;
+                if (entry.ids.size() >= K && memcmp(entry.query.data(), query, dim * sizeof(float)) == 0) {
+                    std::copy(entry.ids.begin(), entry.ids.begin() + K, ids);
+                    std::copy(entry.dists.begin(), entry.dists.begin() + K, dists);
+                    exact_hits_++;
+                    return EXACT;
+                }
+                if (!allow_near) {
+                    misses_++;
+                    return MISS;
+                }
+                seeds = entry.ids;
+                near_hits_++;
+                return NEAR;
+            }
+
+            // 图或数据变化后清空全部条目，命中统计保留
+            void clear() {
+                for (auto &shard : shards_) {
+                    std::lock_guard<std::mutex> guard(shard->lock);
+                    shard->map.clear();
+                    shard->lru.clear();
+                }
+            }
+
+            // 写入查询的前 K 个结果，分片满时淘汰最久未用的条目
+            void insert(const float *query, unsigned dim, uint64_t salt, unsigned K, const unsigned *ids,
+                        const float *dists) {
+                const uint64_t key = Key(query, dim, salt);
+                Shard &shard = *shards_[key % shards_.size()];
+                std::lock_guard<std::mutex> guard(shard.lock);
+                auto it = shard.map.find(key);
+                if (it != shard.map.end()) {
+                    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                } else {
+                    if (shard.map.size() >= shard_capacity_) {
+                        shard.map.erase(shard.lru.back().key);
+                        shard.lru.pop_back();
+                    }
+                    shard.lru.emplace_front();
+                    shard.map[key] = shard.lru.begin();
+                }
+                Entry &entry = shard.lru.front();
+                entry.key = key;
+                entry.query.assign(query, query + dim);
+                entry.ids.clear();
+                entry.dists.clear();
+                for (unsigned i = 0; i < K && ids[i] != (unsigned) -1; i++) {
+                    entry.ids.push_back(ids[i]);
+                    entry.dists.push_back(dists[i]);
+                }
+            }
+
+            size_t exact_hits() const { return exact_hits_; }
+
+            size_t near_hits() const { return near_hits_; }
+
+            size_t misses() const { return misses_; }
+
+        private:
+            struct Entry {
+                uint64_t key;
+                std::vector<float> query;
+                std::vector<unsigned> ids;
+                std::vector<float> dists;
+            };
+
+            struct Shard {
+                std::mutex lock;
+                std::list<Entry> lru;
+                std::unordered_map<uint64_t, std::list<Entry>::iterator> map;
+            };
+
+            // FNV-1a 哈希各维量化后的格号
+            uint64_t Key(const float *query, unsigned dim, uint64_t salt) const {
+                uint64_t h = 14695981039346656037ULL ^ salt;
+                for (unsigned d = 0; d < dim; d++) {
+                    uint64_t cell;
+                    if (step_ > 0) {
+                        cell = (uint64_t) (int64_t) std::floor(query[d] / step_);
+                    } else {
+                        uint32_t bits;
+                        memcpy(&bits, query + d, sizeof(bits));
+                        cell = bits;
+                    }
+                    h = (h ^ cell) * 1099511628211ULL;
+                }
+                return h;
+            }
+
+            std::vector<std::unique_ptr<Shard>> shards_;
+            size_t shard_capacity_;
+            float step_;
+            std::atomic<size_t> exact_hits_, near_hits_, misses_;
+        };
+
+        // 将一段内存按缓存行预取到缓存
+        static inline void Prefetch(const void *addr, size_t bytes) {
+#ifdef __SSE2__
+            const char *p = (const char *) addr;
+            for (size_t off = 0; off < bytes; off += 64) {
+                _mm_prefetch(p + off, _MM_HINT_T0);
+            }
+#endif
+        }
+
+        // 可续搜的贪婪搜索状态：候选池、因池满被拒绝或挤出的候选、访问标记
+        struct SearchState {
+            CandidatePool pool;
+            std::vector<Neighbor> spill;
+            std::vector<char> flags;
+        };
+
+        /**
+         * 构图时每个线程独占的临时空间，由候选与裁剪组件按引用共享：按轮次标记的访问表，
+         * 每个结点开始前 reset() 只递增轮次，不清空整表；候选池与结果缓冲在结点间复用
+         */
+        class BuildScratch {
+        public:
+            // size 为 0 时访问表为空，visited() 恒为 false，供不需要访问标记的裁剪使用
+            explicit BuildScratch(size_t size = 0) : marks_(size, 0) {}
+
+            BuildScratch(const BuildScratch &) = delete;
+
+            BuildScratch &operator=(const BuildScratch &) = delete;
+
+            // 开始处理新结点
+            void reset() {
+                if (++epoch_ == 0) {
+                    std::fill(marks_.begin(), marks_.end(), 0);
+                    epoch_ = 1;
+                }
+            }
+
+            bool visited(unsigned id) const { return id < marks_.size() && marks_[id] == epoch_; }
+
+            void mark(unsigned id) { marks_[id] = epoch_; }
+
+            // 已访问返回 true，否则标记后返回 false
+            bool check_and_mark(unsigned id) {
+                if (marks_[id] == epoch_) return true;
+                marks_[id] = epoch_;
+                return false;
+            }
+
+            CandidatePool candidates;
+            std::vector<unsigned> ids;
+            std::vector<SimpleNeighbor> result;
+
+        private:
+            std::vector<unsigned> marks_;
+            unsigned epoch_ = 1;
+        };
+
         float *getBaseData() const {
             return base_data_;
         }
@@ -1662,6 +2268,11 @@ namespace weavess {
             ground_dim_ = groundDim;
         }
 
+        // 每个基础向量的标签（属性列），用于过滤搜索
+        std::vector<unsigned> &getLabels() {
+            return labels_;
+        }
+
         Parameters &getParam() {
             return param_;
         }
@@ -1746,17 +2357,32 @@ namespace weavess {
             return conn_type;
         }
 
-        unsigned int getDistCount() const {
-            return dist_count;
+        size_t getDistCount() const {
+            return dist_count.load(std::memory_order_relaxed);
         }
 
         void resetDistCount() {
-            dist_count = 0;
+            dist_count.store(0, std::memory_order_relaxed);
+        }
+
+        // 批量查询时多个线程同时累加
+        void addDistCount(unsigned n = 1) {
+            dist_count.fetch_add(n, std::memory_order_relaxed);
         }
 
-        void addDistCount() {
-            dist_count += 1;
+        size_t getHopCount() const {
+            return hop_count.load(std::memory_order_relaxed);
         }
+
+        void resetHopCount() {
+            hop_count.store(0, std::memory_order_relaxed);
+        }
+
+        // 每扩展一个结点的邻居列表计一跳
+        void addHopCount(unsigned n = 1) {
+            hop_count.fetch_add(n, std::memory_order_relaxed);
+        }
+
         void setNumThreads(const unsigned numthreads) {
             omp_set_num_threads(numthreads);
         }
@@ -1769,6 +2395,7 @@ namespace weavess {
         unsigned *ground_data_;
         unsigned base_len_, query_len_, ground_len_;
         unsigned base_dim_, query_dim_, ground_dim_;
+        std::vector<unsigned> labels_;
 
         Parameters param_;
         unsigned init_edges_num;
@@ -1787,7 +2414,8 @@ namespace weavess {
         TYPE prune_type;
         TYPE conn_type;
 
-        unsigned dist_count = 0;
+        std::atomic<size_t> dist_count{0};
+        std::atomic<size_t> hop_count{0};
     };
 }
 
@@ -28,6 +28,13 @@ namespace weavess {
             }
         }
 
+        // 参数不存在时返回默认值
+        template<typename T>
+        inline T get(const std::string &name, const T &default_val) const {
+            auto item = params.find(name);
+            return item == params.end() ? default_val : ConvertStrToValue<T>(item->second);
+        }
+
         inline std::string toString() const {
             std::string res;
             for (auto &param : params) {
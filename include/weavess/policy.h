@@ -23,7 +23,7 @@ namespace weavess {
         SEARCH_ENTRY_RAND, SEARCH_ENTRY_CENTROID, SEARCH_ENTRY_SUB_CENTROID, SEARCH_ENTRY_KDT, SEARCH_ENTRY_KDT_SINGLE, SEARCH_ENTRY_NONE, SEARCH_ENTRY_HASH,
         SEARCH_ENTRY_SPTAG_KDT, SEARCH_ENTRY_SPTAG_BKT, SEARCH_ENTRY_VPT,
 
-        ROUTER_GREEDY, ROUTER_IEH, ROUTER_NSW, ROUTER_HNSW, ROUTER_NGT, ROUTER_BACKTRACK, ROUTER_SPTAG_KDT, ROUTER_SPTAG_BKT, ROUTER_GUIDE
+        ROUTER_GREEDY, ROUTER_IEH, ROUTER_NSW, ROUTER_HNSW, ROUTER_NGT, ROUTER_BACKTRACK, ROUTER_SPTAG_KDT, ROUTER_SPTAG_BKT, ROUTER_GUIDE, ROUTER_BEAM, ROUTER_DISK
 
 
     };
@@ -4,6 +4,7 @@
 
 #include "weavess/builder.h"
 #include "weavess/component.h"
+#include <fcntl.h>
 //#include "weavess/matplotlibcpp.h"
 
 //namespace plt = matplotlibcpp;
@@ -18,7 +19,15 @@ namespace weavess {
      * @param parameters 构建参数
      * @return 当前建造者指针
      */
+    IndexBuilder::~IndexBuilder() {
+        delete search_entry_;
+        delete search_route_;
+        delete query_cache_;
+        delete final_index_;
+    }
+
     IndexBuilder *IndexBuilder::load(char *data_file, char *query_file, char *ground_file, Parameters &parameters) {
+        ClearQueryCache();
         auto *a = new ComponentLoad(final_index_);
 
         a->LoadInner(data_file, query_file, ground_file, parameters);
@@ -37,6 +46,27 @@ namespace weavess {
         return this;
     }
 
+    /**
+     * 仅加载查询集及参数，基础向量不载入内存，配合 load_disk_index 使用
+     * @param query_file *_query.fvecs
+     * @param ground_file *_groundtruth.ivecs
+     * @param parameters 搜索参数
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::load_query(char *query_file, char *ground_file, Parameters &parameters) {
+        auto *a = new ComponentLoad(final_index_);
+
+        a->LoadQueryInner(query_file, ground_file, parameters);
+
+        std::cout << "query data len : " << final_index_->getQueryLen() << std::endl;
+        std::cout << "query data dim : " << final_index_->getQueryDim() << std::endl;
+        std::cout << "ground truth data len : " << final_index_->getGroundLen() << std::endl;
+        std::cout << "ground truth data dim : " << final_index_->getGroundDim() << std::endl;
+        std::cout << "=====================" << std::endl;
+
+        return this;
+    }
+
     /**
     * 构建初始图
     * @param type 初始化类型
@@ -44,6 +74,7 @@ namespace weavess {
     * @return 当前建造者指针
     */
     IndexBuilder *IndexBuilder::init(TYPE type, bool debug) {
+        ClearQueryCache();
         s = std::chrono::high_resolution_clock::now();  //构建开始时间点
         ComponentInit *a = nullptr;
 
@@ -117,6 +148,7 @@ namespace weavess {
      * @return 当前建造者指针
      */
     IndexBuilder *IndexBuilder::refine(TYPE type, bool debug) {
+        ClearQueryCache();
         ComponentRefine *a = nullptr;
 
         if (type == REFINE_NN_DESCENT) {
@@ -183,82 +215,22 @@ namespace weavess {
      * 离线搜索
      * @param entry_type 入口点策略
      * @param route_type 路由策略
+     * @param K 返回近邻个数
      * @return 当前建造者指针
      */
-    IndexBuilder *IndexBuilder::search(TYPE entry_type, TYPE route_type, bool IsControlRecall) {
+    IndexBuilder *IndexBuilder::search(TYPE entry_type, TYPE route_type, bool IsControlRecall, unsigned K) {
         std::cout << "__SEARCH__" << std::endl;
 
-        unsigned K = 10;
-
         final_index_->getParam().set<unsigned>("K_search", K);
 
         std::vector<Index::Neighbor> pool;
         std::vector<std::vector<unsigned>> res;
 
         // ENTRY
-        ComponentSearchEntry *a = nullptr;
-        if (entry_type == SEARCH_ENTRY_RAND) {
-            std::cout << "__SEARCH ENTRY : RAND__" << std::endl;
-            a = new ComponentSearchEntryRand(final_index_);
-        } else if (entry_type == SEARCH_ENTRY_CENTROID) {
-            std::cout << "__SEARCH ENTRY : CENTROID__" << std::endl;
-            a = new ComponentSearchEntryCentroid(final_index_);
-        } else if (entry_type == SEARCH_ENTRY_SUB_CENTROID) {
-            std::cout << "__SEARCH ENTRY : SUB_CENTROID__" << std::endl;
-            a = new ComponentSearchEntrySubCentroid(final_index_);
-        } else if (entry_type == SEARCH_ENTRY_KDT) {
-            std::cout << "__SEARCH ENTRY : KDT__" << std::endl;
-            a = new ComponentSearchEntryKDT(final_index_);
-        } else if (entry_type == SEARCH_ENTRY_KDT_SINGLE) {
-            std::cout << "__SEARCH ENTRY : KDT SINGLE__" << std::endl;
-            a = new ComponentSearchEntryKDTSingle(final_index_);
-        } else if (entry_type == SEARCH_ENTRY_NONE) {
-            std::cout << "__SEARCH ENTRY : NONE__" << std::endl;
-            a = new ComponentSearchEntryNone(final_index_);
-        } else if (entry_type == SEARCH_ENTRY_HASH) {
-            std::cout << "__SEARCH ENTRY : HASH__" << std::endl;
-            a = new ComponentSearchEntryHash(final_index_);
-        } else if (entry_type == SEARCH_ENTRY_VPT) {
-            std::cout << "__SEARCH ENTRY : VPT__" << std::endl;
-            a = new ComponentSearchEntryVPT(final_index_);
-        } else {
-            std::cerr << "__SEARCH ENTRY : WRONG TYPE__" << std::endl;
-            exit(-1);
-        }
+        ComponentSearchEntry *a = GetSearchEntry(entry_type);
 
         // ROUTE
-        ComponentSearchRoute *b = nullptr;
-        if (route_type == ROUTER_GREEDY) {
-            std::cout << "__ROUTER : GREEDY__" << std::endl;
-            b = new ComponentSearchRouteGreedy(final_index_);
-        } else if (route_type == ROUTER_NSW) {
-            std::cout << "__ROUTER : NSW__" << std::endl;
-            b = new ComponentSearchRouteNSW(final_index_);
-        } else if (route_type == ROUTER_HNSW) {
-            std::cout << "__ROUTER : HNSW__" << std::endl;
-            b = new ComponentSearchRouteHNSW(final_index_);
-        } else if (route_type == ROUTER_IEH) {
-            std::cout << "__ROUTER : IEH__" << std::endl;
-            b = new ComponentSearchRouteIEH(final_index_);
-        } else if (route_type == ROUTER_BACKTRACK) {
-            std::cout << "__ROUTER : BACKTRACK__" << std::endl;
-            b = new ComponentSearchRouteBacktrack(final_index_);
-        } else if (route_type == ROUTER_GUIDE) {
-            std::cout << "__ROUTER : GUIDED__" << std::endl;
-            b = new ComponentSearchRouteGuided(final_index_);
-        } else if (route_type == ROUTER_SPTAG_KDT) {
-            std::cout << "__ROUTER : SPTAG_KDT__" << std::endl;
-            b = new ComponentSearchRouteSPTAG_KDT(final_index_);
-        } else if (route_type == ROUTER_SPTAG_BKT) {
-            std::cout << "__ROUTER : SPTAG_BKT__" << std::endl;
-            b = new ComponentSearchRouteSPTAG_BKT(final_index_);
-        } else if (route_type == ROUTER_NGT) {
-            std::cout << "__ROUTER : NGT__" << std::endl;
-            b = new ComponentSearchRouteNGT(final_index_);
-        } else {
-            std::cerr << "__ROUTER : WRONG TYPE__" << std::endl;
-            exit(-1);
-        }
+        ComponentSearchRoute *b = GetSearchRoute(route_type);
 
         if (IsControlRecall) {
             unsigned sg = 1000; //计算L步长的参数
@@ -298,20 +270,7 @@ namespace weavess {
                 std::cout << "DistCount: " << final_index_->getDistCount() << std::endl;
                 final_index_->resetDistCount();
                 //结果评估
-                int cnt = 0;
-                for (unsigned i = 0; i < final_index_->getGroundLen(); i++) {
-                    for (unsigned j = 0; j < K; j++) {
-                        unsigned k = 0;
-                        for (; k < K; k++) {
-                            if (res[i][j] == final_index_->getGroundData()[i * final_index_->getGroundDim() + k])
-                                break;
-                        }
-                        if (k == K)
-                            cnt++;
-                    }
-                }
-
-                float acc = 1 - (float) cnt / (final_index_->getGroundLen() * K);
+                float acc = GetRecall(res, K);
                 std::cout << K << " NN accuracy: " << acc << std::endl;
                 if (acc_set - acc <= 0) {
                     if (L == K || L_sl == 1) {
@@ -383,39 +342,868 @@ namespace weavess {
                 std::cout << "DistCount: " << final_index_->getDistCount() << std::endl;
                 final_index_->resetDistCount();
                 //结果评估
-                int cnt = 0;
-                for (unsigned i = 0; i < final_index_->getGroundLen(); i++) {
-                    for (unsigned j = 0; j < K; j++) {
-                        unsigned k = 0;
-                        for (; k < K; k++) {
-                            if (res[i][j] == final_index_->getGroundData()[i * final_index_->getGroundDim() + k])
-                                break;
-                        }
-                        if (k == K)
-                            cnt++;
+                float acc = GetRecall(res, K);
+                std::cout << K << " NN accuracy: " << acc << std::endl;
+            }
+        }
+
+        e = std::chrono::high_resolution_clock::now();
+        std::cout << "__SEARCH FINISH__" << std::endl;
+
+        return this;
+    }
+
+    /**
+     * 批量搜索，供嵌入服务或压测使用。第 i 个查询的结果按距离升序写入 ids/dists 的 [i * K, (i + 1) * K)，
+     * 不足 K 个时 id 为 -1、距离为 FLT_MAX。L_search 需提前设置（如 load_search_param），
+     * 查询间并行执行，同一建造者不可并发调用。interleave > 1 时每个线程一次交错执行 interleave 个查询
+     * （贪婪与 HNSW 路由支持），以隐藏访存延迟。启用查询结果缓存（enable_query_cache）时逐个查询经缓存执行，不交错
+     * @param entry_type 入口点策略
+     * @param route_type 路由策略
+     * @param queries 查询矩阵，query_num * 维度，维度与 base 相同
+     * @param query_num 查询个数
+     * @param K 返回近邻个数
+     * @param ids 结果 id，query_num * K
+     * @param dists 结果距离，query_num * K
+     * @param interleave 每个线程交错执行的查询数
+     * @param truncated 可选，query_num 个标记，查询因搜索预算（set_search_budget）耗尽而提前返回时为 true
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::search(TYPE entry_type, TYPE route_type, const float *queries, unsigned query_num,
+                                       unsigned K, unsigned *ids, float *dists, unsigned interleave, bool *truncated) {
+        if (entry_type == SEARCH_ENTRY_HASH || route_type == ROUTER_IEH) {
+            std::cerr << "IEH only supports the query set given to load" << std::endl;
+            exit(-1);
+        }
+        if (final_index_->getParam().get<unsigned>("L_search") < K) {
+            std::cout << "search_L cannot be smaller than search_K! " << std::endl;
+            exit(-1);
+        }
+        final_index_->getParam().set<unsigned>("K_search", K);
+        if (interleave == 0) interleave = 1;
+
+        UseSearchComponents(entry_type, route_type);
+        ComponentSearchEntry *a = search_entry_;
+        ComponentSearchRoute *b = search_route_;
+
+        // 路由组件按编号读取查询，临时替换查询集
+        float *query_data = final_index_->getQueryData();
+        unsigned query_len = final_index_->getQueryLen();
+        final_index_->setQueryData(const_cast<float *>(queries));
+        final_index_->setQueryLen(query_num);
+
+        const unsigned group_num = (query_num + interleave - 1) / interleave;
+        const uint64_t salt = query_cache_ ? SearchSalt(entry_type, route_type) : 0;
+#pragma omp parallel
+        {
+            std::vector<std::vector<Index::Neighbor>> pools(interleave);
+            std::unique_ptr<bool[]> flags(new bool[interleave]);
+            std::vector<unsigned> seeds;
+#pragma omp for schedule(dynamic)
+            for (unsigned g = 0; g < group_num; g++) {
+                const unsigned begin = g * interleave;
+                const unsigned num = std::min(interleave, query_num - begin);
+                unsigned *g_ids = ids + (size_t) begin * K;
+                float *g_dists = dists + (size_t) begin * K;
+                std::fill(g_ids, g_ids + (size_t) num * K, (unsigned) -1);
+                std::fill(g_dists, g_dists + (size_t) num * K, std::numeric_limits<float>::max());
+
+                if (query_cache_ != nullptr) {
+                    for (unsigned i = 0; i < num; i++) {
+                        bool cut = SearchCached(a, b, begin + i, K, salt, pools[0], seeds, g_ids + (size_t) i * K,
+                                                g_dists + (size_t) i * K);
+                        if (truncated) truncated[begin + i] = cut;
                     }
+                    continue;
+                }
 
-    //                for(unsigned j = 0; j < K; j ++) {
-    //                    std::cout << res[i][j] << " ";
-    //                }
-    //                std::cout << std::endl;
-    //                for(unsigned j = 0; j < K; j ++) {
-    //                    std::cout << final_index_->getGroundData()[i * final_index_->getGroundDim() + j] << " ";
-    //                }
-    //                std::cout << std::endl;
+                for (unsigned i = 0; i < num; i++) {
+                    pools[i].clear();
+                    a->SearchEntryInner(begin + i, pools[i]);
                 }
+                b->RouteInterleaved(begin, num, pools, g_ids, g_dists, truncated ? truncated + begin : flags.get());
+            }
+        }
 
-                float acc = 1 - (float) cnt / (final_index_->getGroundLen() * K);
-                std::cout << K << " NN accuracy: " << acc << std::endl;
+        final_index_->setQueryData(query_data);
+        final_index_->setQueryLen(query_len);
+
+        return this;
+    }
+
+    /**
+     * 批量范围搜索：返回每个查询距离不超过 radius 的点，用于去重、近重复检测等结果个数不定的场景。
+     * 先以路由的 L_search 个近邻为种子，再沿图扩展距离不超过 explorationCoefficient * radius 的点，
+     * L_search 需提前设置，查询间并行执行
+     * @param entry_type 入口点策略
+     * @param route_type 路由策略
+     * @param queries 查询矩阵，query_num * 维度，维度与 base 相同
+     * @param query_num 查询个数
+     * @param radius 半径，与距离同量纲（L2 平方）
+     * @param cap 每个查询的结果个数上限，达到后停止扩展，0 表示不限
+     * @param res 每个查询的结果，按距离升序
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::range_search(TYPE entry_type, TYPE route_type, const float *queries,
+                                             unsigned query_num, float radius, unsigned cap,
+                                             std::vector<std::vector<Index::SimpleNeighbor>> &res) {
+        if (entry_type == SEARCH_ENTRY_HASH || route_type == ROUTER_IEH) {
+            std::cerr << "IEH only supports the query set given to load" << std::endl;
+            exit(-1);
+        }
+        final_index_->getParam().set<unsigned>("K_search", final_index_->getParam().get<unsigned>("L_search"));
+
+        UseSearchComponents(entry_type, route_type);
+        ComponentSearchEntry *a = search_entry_;
+        ComponentSearchRoute *b = search_route_;
+
+        // 路由组件按编号读取查询，临时替换查询集
+        float *query_data = final_index_->getQueryData();
+        unsigned query_len = final_index_->getQueryLen();
+        final_index_->setQueryData(const_cast<float *>(queries));
+        final_index_->setQueryLen(query_num);
+
+        res.resize(query_num);
+#pragma omp parallel
+        {
+            std::vector<Index::Neighbor> pool;
+#pragma omp for schedule(dynamic)
+            for (unsigned i = 0; i < query_num; i++) {
+                pool.clear();
+                a->SearchEntryInner(i, pool);
+                b->RangeSearch(i, pool, radius, cap, res[i]);
             }
         }
 
-        e = std::chrono::high_resolution_clock::now();
-        std::cout << "__SEARCH FINISH__" << std::endl;
+        final_index_->setQueryData(query_data);
+        final_index_->setQueryLen(query_len);
+
+        return this;
+    }
+
+    /**
+     * 加载标签列（属性列），供 label_filter 生成过滤位图
+     * @param label_file *.ivecs，每个基础向量一个标签
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::load_labels(char *label_file) {
+        auto *a = new ComponentLoad(final_index_);
+
+        a->LoadLabelsInner(label_file);
+
+        std::cout << "label len : " << final_index_->getLabels().size() << std::endl;
+        return this;
+    }
+
+    /**
+     * 生成标签属于 labels 的基础向量的过滤位图
+     * @param labels 允许的标签
+     * @param filter 过滤位图，长度为基础向量个数
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::label_filter(const std::vector<unsigned> &labels, boost::dynamic_bitset<> &filter) {
+        const auto &column = final_index_->getLabels();
+        if (column.size() != final_index_->getBaseLen()) {
+            std::cerr << "labels are not loaded" << std::endl;
+            exit(-1);
+        }
+        std::unordered_set<unsigned> allowed(labels.begin(), labels.end());
+        filter.resize(column.size());
+        filter.reset();
+        for (size_t i = 0; i < column.size(); i++) {
+            if (allowed.count(column[i])) filter.set(i);
+        }
+        return this;
+    }
+
+    /**
+     * 批量过滤搜索：只返回过滤位图中为 1 的点。贪婪与 HNSW 路由在遍历中过滤，途经不满足条件的点但不计入结果；
+     * 其他路由及满足条件的点不超过 filter_brute_force_num（默认 2000）时暴力搜索。
+     * 结果布局与批量 search 相同，L_search 需提前设置，查询间并行执行
+     * @param entry_type 入口点策略
+     * @param route_type 路由策略
+     * @param queries 查询矩阵，query_num * 维度，维度与 base 相同
+     * @param query_num 查询个数
+     * @param K 返回近邻个数
+     * @param filters 过滤位图，只有 1 个时所有查询共用，否则每个查询 1 个
+     * @param ids 结果 id，query_num * K
+     * @param dists 结果距离，query_num * K
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::filtered_search(TYPE entry_type, TYPE route_type, const float *queries,
+                                                unsigned query_num, unsigned K,
+                                                const std::vector<boost::dynamic_bitset<>> &filters, unsigned *ids,
+                                                float *dists) {
+        if (entry_type == SEARCH_ENTRY_HASH || route_type == ROUTER_IEH) {
+            std::cerr << "IEH only supports the query set given to load" << std::endl;
+            exit(-1);
+        }
+        if (filters.size() != 1 && filters.size() != query_num) {
+            std::cerr << "filters must be one shared bitmap or one per query" << std::endl;
+            exit(-1);
+        }
+        if (final_index_->getParam().get<unsigned>("L_search") < K) {
+            std::cout << "search_L cannot be smaller than search_K! " << std::endl;
+            exit(-1);
+        }
+        final_index_->getParam().set<unsigned>("K_search", K);
+
+        UseSearchComponents(entry_type, route_type);
+        ComponentSearchEntry *a = search_entry_;
+        ComponentSearchRoute *b = search_route_;
+
+        std::vector<size_t> match_num(filters.size());
+        for (size_t i = 0; i < filters.size(); i++) match_num[i] = filters[i].count();
+
+        // 路由组件按编号读取查询，临时替换查询集
+        float *query_data = final_index_->getQueryData();
+        unsigned query_len = final_index_->getQueryLen();
+        final_index_->setQueryData(const_cast<float *>(queries));
+        final_index_->setQueryLen(query_num);
+
+        std::fill(ids, ids + (size_t) query_num * K, (unsigned) -1);
+        std::fill(dists, dists + (size_t) query_num * K, std::numeric_limits<float>::max());
+#pragma omp parallel
+        {
+            std::vector<Index::Neighbor> pool;
+#pragma omp for schedule(dynamic)
+            for (unsigned i = 0; i < query_num; i++) {
+                const unsigned f = filters.size() == 1 ? 0 : i;
+                pool.clear();
+                a->SearchEntryInner(i, pool);
+                b->FilteredSearch(i, pool, filters[f], match_num[f], ids + (size_t) i * K, dists + (size_t) i * K);
+            }
+        }
+
+        final_index_->setQueryData(query_data);
+        final_index_->setQueryLen(query_len);
+
+        return this;
+    }
+
+    /**
+     * 经查询结果缓存执行单个查询：完全命中时直接返回缓存结果；近似命中且路由从候选池出发时，将缓存结果按距离并入候选池，
+     * 以更近的种子缩短遍历；未截断的结果写回缓存
+     * @param a 入口点组件
+     * @param b 路由组件
+     * @param query 查询点
+     * @param K 返回近邻个数
+     * @param salt 搜索配置哈希
+     * @param pool 候选池
+     * @param seeds 近似命中时的种子
+     * @param ids 结果 id
+     * @param dists 结果距离
+     * @return 是否因搜索预算耗尽而截断
+     */
+    bool IndexBuilder::SearchCached(ComponentSearchEntry *a, ComponentSearchRoute *b, unsigned query, unsigned K,
+                                    uint64_t salt, std::vector<Index::Neighbor> &pool, std::vector<unsigned> &seeds,
+                                    unsigned *ids, float *dists) {
+        const unsigned dim = final_index_->getQueryDim();
+        const float *query_data = final_index_->getQueryData() + (size_t) query * dim;
+        Index::QueryCache::Result hit = query_cache_->lookup(query_data, dim, salt, K, ids, dists, seeds,
+                                                             b->ReadsPool());
+        if (hit == Index::QueryCache::EXACT) return false;
+
+        pool.clear();
+        a->SearchEntryInner(query, pool);
+        if (hit == Index::QueryCache::NEAR) {
+            // 种子与入口点按距离合并去重，保留最近的 L_search 个，路由只读取候选池前 L_search 个
+            const auto L = final_index_->getParam().get<unsigned>("L_search");
+            for (unsigned id : seeds) {
+                float dist = final_index_->getDist()->compare(query_data,
+                                                              final_index_->getBaseData() + (size_t) id * dim, dim);
+                pool.emplace_back(id, dist, true);
+            }
+            final_index_->addDistCount(seeds.size());
+            std::stable_sort(pool.begin(), pool.end());
+            std::unordered_set<unsigned> seen;
+            size_t n = 0;
+            for (size_t i = 0; i < pool.size() && n < L; i++) {
+                if (seen.insert(pool[i].id).second) pool[n++] = pool[i];
+            }
+            pool.resize(n);
+        }
+
+        bool truncated = b->RouteInner(query, pool, ids, dists);
+        if (!truncated) query_cache_->insert(query_data, dim, salt, K, ids, dists);
+        return truncated;
+    }
+
+    /**
+     * 查询结果缓存的配置哈希：入口点、路由、L_search、自适应终止、搜索预算与 explorationCoefficient，
+     * 任一项不同时结果互不命中
+     */
+    uint64_t IndexBuilder::SearchSalt(TYPE entry_type, TYPE route_type) {
+        Parameters &param = final_index_->getParam();
+        float ratio = param.get<float>("early_stop_ratio", 0);
+        float ec = final_index_->explorationCoefficient;
+        uint32_t ratio_bits, ec_bits;
+        memcpy(&ratio_bits, &ratio, sizeof(ratio_bits));
+        memcpy(&ec_bits, &ec, sizeof(ec_bits));
+        const uint64_t fields[] = {(uint64_t) entry_type, (uint64_t) route_type, param.get<unsigned>("L_search"),
+                                   param.get<unsigned>("early_stop_patience", 0), ratio_bits,
+                                   param.get<unsigned>("search_time_budget_us", 0),
+                                   param.get<unsigned>("search_dist_budget", 0), ec_bits};
+        uint64_t h = 14695981039346656037ULL;
+        for (uint64_t f : fields) h = (h ^ f) * 1099511628211ULL;
+        return h;
+    }
+
+    // 图或数据变化后缓存结果失效
+    void IndexBuilder::ClearQueryCache() {
+        if (query_cache_ != nullptr) query_cache_->clear();
+    }
+
+    /**
+     * 启用批量搜索前置的查询结果缓存，capacity 为 0 时关闭
+     * @param capacity 缓存条目数
+     * @param quant_step 查询向量各维的量化步长，落在同一格的查询视为近似重复；不大于 0 时只缓存完全相同的查询
+     * @param shard_num 分片数，各分片独立加锁
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::enable_query_cache(size_t capacity, float quant_step, unsigned shard_num) {
+        delete query_cache_;
+        query_cache_ = capacity == 0 ? nullptr : new Index::QueryCache(capacity, quant_step, shard_num);
+        return this;
+    }
+
+    /**
+     * 查询结果缓存的命中统计，未启用时均为 0
+     * @param exact_hits 完全命中次数
+     * @param near_hits 近似命中次数
+     * @param misses 未命中次数
+     */
+    void IndexBuilder::query_cache_stats(size_t &exact_hits, size_t &near_hits, size_t &misses) const {
+        exact_hits = query_cache_ ? query_cache_->exact_hits() : 0;
+        near_hits = query_cache_ ? query_cache_->near_hits() : 0;
+        misses = query_cache_ ? query_cache_->misses() : 0;
+    }
+
+    /**
+     * 设置单个查询的搜索预算，贪婪、束搜索、磁盘、NSW、HNSW、NGT、SPTAG 路由在预算耗尽时以当前最优 K 个结果返回，
+     * 并将该查询标记为截断。预算从路由开始计，不含入口点阶段
+     * @param time_us 耗时上限（微秒），0 表示不限
+     * @param dist_num 距离计算次数上限，0 表示不限
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::set_search_budget(unsigned time_us, unsigned dist_num) {
+        final_index_->getParam().set<unsigned>("search_time_budget_us", time_us);
+        final_index_->getParam().set<unsigned>("search_dist_budget", dist_num);
+        return this;
+    }
+
+    /**
+     * 设置贪婪路由的自适应终止条件，sweep 输出中记录该设置，便于与完整搜索对比 recall/QPS
+     * @param patience 前 K 个结果连续 patience 次扩展未变化时停止，0 表示不启用
+     * @param ratio 最近的未扩展候选距离超过第 K 个结果的 ratio 倍时停止（距离为 L2 平方），0 表示不启用
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::set_early_stop(unsigned patience, float ratio) {
+        final_index_->getParam().set<unsigned>("early_stop_patience", patience);
+        final_index_->getParam().set<float>("early_stop_ratio", ratio);
+        return this;
+    }
+
+    /**
+     * 参数扫描：遍历 L 及 explorationCoefficient 组合，输出 recall/QPS 等指标（含因搜索预算截断的查询比例），
+     * 便于比较不同版本并自动挑选工作点
+     * @param entry_type 入口点策略
+     * @param route_type 路由策略
+     * @param K 返回近邻个数
+     * @param L_list 待扫描的 L_search
+     * @param ec_list 待扫描的 explorationCoefficient（仅 NGT 路由生效），为空时使用当前值
+     * @param result_file 结果文件，以 .json 结尾时输出 JSON，否则输出 CSV
+     * @param incremental 仅贪婪路由：每个查询按 L 从小到大续搜，复用上一个 L 的候选池和访问标记，
+     *                    此时时延、距离计算次数均为截至该 L 的累计值，且不受搜索预算限制
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::sweep(TYPE entry_type, TYPE route_type, unsigned K, const std::vector<unsigned> &L_list,
+                                      const std::vector<float> &ec_list, char *result_file, bool incremental) {
+        std::cout << "__SWEEP__" << std::endl;
+
+        if (K > final_index_->getGroundDim()) {
+            std::cerr << "search_K cannot be larger than ground truth dim! " << std::endl;
+            exit(-1);
+        }
+        final_index_->getParam().set<unsigned>("K_search", K);
+
+        UseSearchComponents(entry_type, route_type);
+        ComponentSearchEntry *a = search_entry_;
+        ComponentSearchRoute *b = search_route_;
+
+        if (incremental && route_type != ROUTER_GREEDY) {
+            std::cout << "incremental sweep only supports ROUTER_GREEDY, fall back to full search" << std::endl;
+            incremental = false;
+        }
+
+        std::vector<unsigned> Ls;
+        for (unsigned L : L_list) {
+            if (L < K) {
+                std::cout << "search_L cannot be smaller than search_K! skip L = " << L << std::endl;
+                continue;
+            }
+            Ls.push_back(L);
+        }
+        if (incremental) std::sort(Ls.begin(), Ls.end());
+
+        const auto patience = final_index_->getParam().get<unsigned>("early_stop_patience", 0);
+        const auto ratio = final_index_->getParam().get<float>("early_stop_ratio", 0);
+
+        std::vector<float> ecs(ec_list);
+        const float ec_origin = final_index_->explorationCoefficient;
+        if (ecs.empty()) ecs.push_back(ec_origin);
+
+        std::string file(result_file);
+        bool json = file.size() >= 5 && file.compare(file.size() - 5, 5, ".json") == 0;
+        std::ofstream out(result_file, std::ios::out);
+        if (!out.is_open()) {
+            std::cerr << "open file error" << std::endl;
+            exit(-1);
+        }
+        if (json) {
+            out << "[";
+        } else {
+            out << "entry,router,K,L,exploration_coefficient,incremental,early_stop_patience,early_stop_ratio,recall,qps,"
+                   "mean_us,p50_us,p90_us,p95_us,p99_us,dist_per_query,hops_per_query,truncated" << std::endl;
+        }
+
+        const unsigned query_num = final_index_->getQueryLen();
+        std::vector<Index::Neighbor> pool;
+        std::vector<std::vector<std::vector<unsigned>>> res(Ls.size(), std::vector<std::vector<unsigned>>(query_num));
+        std::vector<std::vector<double>> latency(Ls.size(), std::vector<double>(query_num));
+        std::vector<double> total_time(Ls.size());
+        std::vector<size_t> dist_count(Ls.size()), hop_count(Ls.size()), truncated(Ls.size());
+        bool first_row = true;
+        ComponentSearchRouteGreedy greedy(final_index_);
+
+        for (float ec : ecs) {
+            final_index_->explorationCoefficient = ec;
+            std::fill(total_time.begin(), total_time.end(), 0);
+            std::fill(dist_count.begin(), dist_count.end(), 0);
+            std::fill(hop_count.begin(), hop_count.end(), 0);
+            std::fill(truncated.begin(), truncated.end(), 0);
+
+            if (incremental) {
+                Index::SearchState state;
+                if (!Ls.empty()) final_index_->getParam().set<unsigned>("L_search", Ls[0]);
+                for (unsigned i = 0; i < query_num; i++) {
+                    final_index_->resetDistCount();
+                    final_index_->resetHopCount();
+                    auto q1 = std::chrono::high_resolution_clock::now();
+                    pool.clear();
+                    a->SearchEntryInner(i, pool);
+                    greedy.InitState(pool, state);
+                    for (unsigned l = 0; l < Ls.size(); l++) {
+                        res[l][i].clear();
+                        greedy.RouteResume(i, Ls[l], state, res[l][i]);
+
+                        std::chrono::duration<double, std::micro> q_diff = std::chrono::high_resolution_clock::now() - q1;
+                        latency[l][i] = q_diff.count();
+                        total_time[l] += q_diff.count() / 1e6;
+                        dist_count[l] += final_index_->getDistCount();
+                        hop_count[l] += final_index_->getHopCount();
+                    }
+                }
+            } else {
+                for (unsigned l = 0; l < Ls.size(); l++) {
+                    final_index_->getParam().set<unsigned>("L_search", Ls[l]);
+                    final_index_->resetDistCount();
+                    final_index_->resetHopCount();
+
+                    auto s1 = std::chrono::high_resolution_clock::now();
+                    for (unsigned i = 0; i < query_num; i++) {
+                        auto q1 = std::chrono::high_resolution_clock::now();
+                        pool.clear();
+                        res[l][i].clear();
+
+                        a->SearchEntryInner(i, pool);
+                        truncated[l] += b->RouteInner(i, pool, res[l][i]);
+
+                        std::chrono::duration<double, std::micro> q_diff = std::chrono::high_resolution_clock::now() - q1;
+                        latency[l][i] = q_diff.count();
+                    }
+                    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - s1;
+                    total_time[l] = diff.count();
+                    dist_count[l] = final_index_->getDistCount();
+                    hop_count[l] = final_index_->getHopCount();
+                }
+            }
+
+            for (unsigned l = 0; l < Ls.size(); l++) {
+                const unsigned L = Ls[l];
+                float acc = GetRecall(res[l], K);
+                double qps = query_num / total_time[l];
+                double mean_us = total_time[l] * 1e6 / query_num;
+                double dist_per_query = (double) dist_count[l] / query_num;
+                double hops_per_query = (double) hop_count[l] / query_num;
+                double truncated_rate = (double) truncated[l] / query_num;
+
+                std::vector<double> sorted(latency[l]);
+                std::sort(sorted.begin(), sorted.end());
+                auto percentile = [&sorted](double p) {
+                    auto rank = (size_t) std::ceil(p * sorted.size());
+                    return sorted[rank == 0 ? 0 : rank - 1];
+                };
+
+                std::cout << "SEARCH_L : " << L << " explorationCoefficient : " << ec << " " << K
+                          << " NN accuracy: " << acc << " QPS: " << qps << std::endl;
+
+                if (json) {
+                    out << (first_row ? "\n" : ",\n")
+                        << "  {\"entry\": \"" << GetTypeName(entry_type) << "\", \"router\": \"" << GetTypeName(route_type)
+                        << "\", \"K\": " << K << ", \"L\": " << L << ", \"exploration_coefficient\": " << ec
+                        << ", \"incremental\": " << (incremental ? "true" : "false")
+                        << ", \"early_stop_patience\": " << patience << ", \"early_stop_ratio\": " << ratio
+                        << ", \"recall\": " << acc << ", \"qps\": " << qps << ", \"mean_us\": " << mean_us
+                        << ", \"p50_us\": " << percentile(0.5) << ", \"p90_us\": " << percentile(0.9)
+                        << ", \"p95_us\": " << percentile(0.95) << ", \"p99_us\": " << percentile(0.99)
+                        << ", \"dist_per_query\": " << dist_per_query << ", \"hops_per_query\": " << hops_per_query
+                        << ", \"truncated\": " << truncated_rate << "}";
+                } else {
+                    out << GetTypeName(entry_type) << "," << GetTypeName(route_type) << "," << K << "," << L << ","
+                        << ec << "," << (incremental ? 1 : 0) << "," << patience << "," << ratio << "," << acc << ","
+                        << qps << "," << mean_us << ","
+                        << percentile(0.5) << "," << percentile(0.9) << "," << percentile(0.95) << ","
+                        << percentile(0.99) << "," << dist_per_query << "," << hops_per_query << "," << truncated_rate
+                        << std::endl;
+                }
+                first_row = false;
+            }
+        }
+        if (json) out << "\n]" << std::endl;
+        out.close();
+
+        final_index_->explorationCoefficient = ec_origin;
+        final_index_->resetDistCount();
+        final_index_->resetHopCount();
+
+        std::cout << "__SWEEP FINISH__" << std::endl;
 
         return this;
     }
 
+    /**
+     * 根据类型创建入口点组件
+     * @param entry_type 入口点策略
+     * @return 入口点组件
+     */
+    ComponentSearchEntry *IndexBuilder::GetSearchEntry(TYPE entry_type) {
+        ComponentSearchEntry *a = nullptr;
+        if (entry_type == SEARCH_ENTRY_RAND) {
+            std::cout << "__SEARCH ENTRY : RAND__" << std::endl;
+            a = new ComponentSearchEntryRand(final_index_);
+        } else if (entry_type == SEARCH_ENTRY_CENTROID) {
+            std::cout << "__SEARCH ENTRY : CENTROID__" << std::endl;
+            a = new ComponentSearchEntryCentroid(final_index_);
+        } else if (entry_type == SEARCH_ENTRY_SUB_CENTROID) {
+            std::cout << "__SEARCH ENTRY : SUB_CENTROID__" << std::endl;
+            a = new ComponentSearchEntrySubCentroid(final_index_);
+        } else if (entry_type == SEARCH_ENTRY_KDT) {
+            std::cout << "__SEARCH ENTRY : KDT__" << std::endl;
+            a = new ComponentSearchEntryKDT(final_index_);
+        } else if (entry_type == SEARCH_ENTRY_KDT_SINGLE) {
+            std::cout << "__SEARCH ENTRY : KDT SINGLE__" << std::endl;
+            a = new ComponentSearchEntryKDTSingle(final_index_);
+        } else if (entry_type == SEARCH_ENTRY_NONE) {
+            std::cout << "__SEARCH ENTRY : NONE__" << std::endl;
+            a = new ComponentSearchEntryNone(final_index_);
+        } else if (entry_type == SEARCH_ENTRY_HASH) {
+            std::cout << "__SEARCH ENTRY : HASH__" << std::endl;
+            a = new ComponentSearchEntryHash(final_index_);
+        } else if (entry_type == SEARCH_ENTRY_VPT) {
+            std::cout << "__SEARCH ENTRY : VPT__" << std::endl;
+            a = new ComponentSearchEntryVPT(final_index_);
+        } else {
+            std::cerr << "__SEARCH ENTRY : WRONG TYPE__" << std::endl;
+            exit(-1);
+        }
+
+
+        return a;
+    }
+
+    /**
+     * 根据类型创建路由组件
+     * @param route_type 路由策略
+     * @return 路由组件
+     */
+    ComponentSearchRoute *IndexBuilder::GetSearchRoute(TYPE route_type) {
+        ComponentSearchRoute *b = nullptr;
+        if (route_type == ROUTER_GREEDY) {
+            std::cout << "__ROUTER : GREEDY__" << std::endl;
+            b = new ComponentSearchRouteGreedy(final_index_);
+        } else if (route_type == ROUTER_NSW) {
+            std::cout << "__ROUTER : NSW__" << std::endl;
+            b = new ComponentSearchRouteNSW(final_index_);
+        } else if (route_type == ROUTER_HNSW) {
+            std::cout << "__ROUTER : HNSW__" << std::endl;
+            b = new ComponentSearchRouteHNSW(final_index_);
+        } else if (route_type == ROUTER_IEH) {
+            std::cout << "__ROUTER : IEH__" << std::endl;
+            b = new ComponentSearchRouteIEH(final_index_);
+        } else if (route_type == ROUTER_BACKTRACK) {
+            std::cout << "__ROUTER : BACKTRACK__" << std::endl;
+            b = new ComponentSearchRouteBacktrack(final_index_);
+        } else if (route_type == ROUTER_GUIDE) {
+            std::cout << "__ROUTER : GUIDED__" << std::endl;
+            b = new ComponentSearchRouteGuided(final_index_);
+        } else if (route_type == ROUTER_BEAM) {
+            std::cout << "__ROUTER : BEAM__" << std::endl;
+            b = new ComponentSearchRouteBeam(final_index_);
+        } else if (route_type == ROUTER_DISK) {
+            std::cout << "__ROUTER : DISK__" << std::endl;
+            b = new ComponentSearchRouteDisk(final_index_);
+        } else if (route_type == ROUTER_SPTAG_KDT) {
+            std::cout << "__ROUTER : SPTAG_KDT__" << std::endl;
+            b = new ComponentSearchRouteSPTAG_KDT(final_index_);
+        } else if (route_type == ROUTER_SPTAG_BKT) {
+            std::cout << "__ROUTER : SPTAG_BKT__" << std::endl;
+            b = new ComponentSearchRouteSPTAG_BKT(final_index_);
+        } else if (route_type == ROUTER_NGT) {
+            std::cout << "__ROUTER : NGT__" << std::endl;
+            b = new ComponentSearchRouteNGT(final_index_);
+        } else {
+            std::cerr << "__ROUTER : WRONG TYPE__" << std::endl;
+            exit(-1);
+        }
+
+
+        return b;
+    }
+
+    /**
+     * 批量搜索复用的入口点与路由组件，类型变化时释放旧组件后重新创建
+     * @param entry_type 入口点策略
+     * @param route_type 路由策略
+     */
+    void IndexBuilder::UseSearchComponents(TYPE entry_type, TYPE route_type) {
+        if (search_entry_ == nullptr || search_entry_type_ != entry_type) {
+            delete search_entry_;
+            search_entry_ = GetSearchEntry(entry_type);
+            search_entry_type_ = entry_type;
+        }
+        if (search_route_ == nullptr || search_route_type_ != route_type) {
+            delete search_route_;
+            search_route_ = GetSearchRoute(route_type);
+            search_route_type_ = route_type;
+        }
+    }
+
+    /**
+     * 自动调参：在查询样本上倍增定界并二分查找满足目标 recall@K 的最小 L，
+     * 用剩余查询验证后将结果保存至 graph_file + ".search"，供 load_search_param 直接载入
+     * @param entry_type 入口点策略
+     * @param route_type 路由策略
+     * @param K 返回近邻个数
+     * @param target_recall 目标 recall@K
+     * @param sample_num 调参使用的查询个数，其余查询用于验证
+     * @param graph_file 图索引地址
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::tune(TYPE entry_type, TYPE route_type, unsigned K, float target_recall,
+                                     unsigned sample_num, char *graph_file) {
+        std::cout << "__TUNE__" << std::endl;
+
+        const unsigned query_num = std::min(final_index_->getQueryLen(), final_index_->getGroundLen());
+        if (K > final_index_->getGroundDim()) {
+            std::cerr << "search_K cannot be larger than ground truth dim! " << std::endl;
+            exit(-1);
+        }
+        final_index_->getParam().set<unsigned>("K_search", K);
+
+        UseSearchComponents(entry_type, route_type);
+        ComponentSearchEntry *a = search_entry_;
+        ComponentSearchRoute *b = search_route_;
+
+        // 固定种子划分调参集与验证集
+        std::vector<unsigned> ids(query_num);
+        for (unsigned i = 0; i < query_num; i++) ids[i] = i;
+        std::mt19937 rng(2021);
+        std::shuffle(ids.begin(), ids.end(), rng);
+        sample_num = std::min(std::max(sample_num, 1u), query_num);
+        std::vector<unsigned> sample(ids.begin(), ids.begin() + sample_num);
+        std::vector<unsigned> held_out(ids.begin() + sample_num, ids.end());
+
+        auto eval = [&](unsigned L) {
+            final_index_->getParam().set<unsigned>("L_search", L);
+            float acc = GetSampleRecall(a, b, sample, K);
+            std::cout << "SEARCH_L : " << L << " " << K << " NN accuracy: " << acc << std::endl;
+            return acc;
+        };
+
+        // 倍增定界 (lo, hi]，hi 满足目标
+        const unsigned L_max = std::max(final_index_->getBaseLen() - 1, K);
+        unsigned lo = K, hi = K;
+        float hi_acc = eval(hi);
+        if (hi_acc < target_recall) {
+            while (hi_acc < target_recall && hi < L_max) {
+                lo = hi;
+                hi = std::min(hi * 2, L_max);
+                hi_acc = eval(hi);
+            }
+            if (hi_acc < target_recall) {
+                std::cout << "target recall unreachable, use L = " << hi << std::endl;
+            }
+            // 二分
+            while (hi_acc >= target_recall && hi - lo > 1) {
+                unsigned mid = lo + (hi - lo) / 2;
+                float mid_acc = eval(mid);
+                if (mid_acc >= target_recall) {
+                    hi = mid;
+                    hi_acc = mid_acc;
+                } else {
+                    lo = mid;
+                }
+            }
+        }
+
+        final_index_->getParam().set<unsigned>("L_search", hi);
+        float held_out_acc = held_out.empty() ? hi_acc : GetSampleRecall(a, b, held_out, K);
+        std::cout << "TUNED L_search : " << hi << " sample recall: " << hi_acc
+                  << " held-out recall: " << held_out_acc << std::endl;
+
+        std::string param_file = std::string(graph_file) + ".search";
+        std::ofstream out(param_file, std::ios::out);
+        if (!out.is_open()) {
+            std::cerr << "open file error" << std::endl;
+            exit(-1);
+        }
+        out << "entry:" << GetTypeName(entry_type) << std::endl;
+        out << "router:" << GetTypeName(route_type) << std::endl;
+        out << "K_search:" << K << std::endl;
+        out << "L_search:" << hi << std::endl;
+        out << "target_recall:" << target_recall << std::endl;
+        out << "sample_recall:" << hi_acc << std::endl;
+        out << "held_out_recall:" << held_out_acc << std::endl;
+        out.close();
+
+        std::cout << "__TUNE FINISH__" << std::endl;
+
+        return this;
+    }
+
+    /**
+     * 载入 tune 保存的搜索参数（K_search、L_search）
+     * @param graph_file 图索引地址
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::load_search_param(char *graph_file) {
+        std::string param_file = std::string(graph_file) + ".search";
+        std::ifstream in(param_file, std::ios::in);
+        if (!in.is_open()) {
+            std::cerr << "open file error" << std::endl;
+            exit(-1);
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            auto pos = line.find(':');
+            if (pos == std::string::npos) continue;
+            std::string name = line.substr(0, pos);
+            if (name == "K_search" || name == "L_search") {
+                final_index_->getParam().set<std::string>(name, line.substr(pos + 1));
+            }
+        }
+        in.close();
+
+        std::cout << "K_search : " << final_index_->getParam().get<unsigned>("K_search")
+                  << " L_search : " << final_index_->getParam().get<unsigned>("L_search") << std::endl;
+
+        return this;
+    }
+
+    /**
+     * 入口点及路由策略名称，用于输出扫描结果
+     * @param type 策略类型
+     * @return 策略名称
+     */
+    const char *IndexBuilder::GetTypeName(TYPE type) {
+        switch (type) {
+            case SEARCH_ENTRY_RAND: return "RAND";
+            case SEARCH_ENTRY_CENTROID: return "CENTROID";
+            case SEARCH_ENTRY_SUB_CENTROID: return "SUB_CENTROID";
+            case SEARCH_ENTRY_KDT: return "KDT";
+            case SEARCH_ENTRY_KDT_SINGLE: return "KDT_SINGLE";
+            case SEARCH_ENTRY_NONE: return "NONE";
+            case SEARCH_ENTRY_HASH: return "HASH";
+            case SEARCH_ENTRY_VPT: return "VPT";
+            case ROUTER_GREEDY: return "GREEDY";
+            case ROUTER_NSW: return "NSW";
+            case ROUTER_HNSW: return "HNSW";
+            case ROUTER_IEH: return "IEH";
+            case ROUTER_BACKTRACK: return "BACKTRACK";
+            case ROUTER_GUIDE: return "GUIDED";
+            case ROUTER_BEAM: return "BEAM";
+            case ROUTER_DISK: return "DISK";
+            case ROUTER_SPTAG_KDT: return "SPTAG_KDT";
+            case ROUTER_SPTAG_BKT: return "SPTAG_BKT";
+            case ROUTER_NGT: return "NGT";
+            default: return "UNKNOWN";
+        }
+    }
+
+    /**
+     * 计算 recall@K，结果不足 K 个时缺失部分按未命中计
+     * @param res 每个查询的结果集
+     * @param K 评估的近邻个数
+     * @return recall@K
+     */
+    float IndexBuilder::GetRecall(std::vector<std::vector<unsigned>> &res, unsigned K) {
+        size_t hits = 0;
+        for (unsigned i = 0; i < final_index_->getGroundLen(); i++) {
+            hits += GetHits(i, res[i], K);
+        }
+
+        return (float) hits / (final_index_->getGroundLen() * K);
+    }
+
+    /**
+     * 单个查询结果中属于真实 K 近邻的个数
+     * @param query 查询点
+     * @param res 该查询的结果集
+     * @param K 评估的近邻个数
+     * @return 命中个数
+     */
+    unsigned IndexBuilder::GetHits(unsigned query, const std::vector<unsigned> &res, unsigned K) {
+        const unsigned *gt = final_index_->getGroundData() + (size_t) query * final_index_->getGroundDim();
+        unsigned hits = 0;
+        for (unsigned j = 0; j < K && j < res.size(); j++) {
+            for (unsigned k = 0; k < K; k++) {
+                if (res[j] == gt[k]) {
+                    hits++;
+                    break;
+                }
+            }
+        }
+        return hits;
+    }
+
+    /**
+     * 在给定查询子集上并行搜索并计算 recall@K
+     * @param a 入口点组件
+     * @param b 路由组件
+     * @param queries 查询子集
+     * @param K 评估的近邻个数
+     * @return recall@K
+     */
+    float IndexBuilder::GetSampleRecall(ComponentSearchEntry *a, ComponentSearchRoute *b,
+                                        const std::vector<unsigned> &queries, unsigned K) {
+        size_t hits = 0;
+#pragma omp parallel
+        {
+            std::vector<Index::Neighbor> pool;
+            std::vector<unsigned> res;
+#pragma omp for schedule(dynamic) reduction(+:hits)
+            for (size_t i = 0; i < queries.size(); i++) {
+                pool.clear();
+                res.clear();
+                a->SearchEntryInner(queries[i], pool);
+                b->RouteInner(queries[i], pool, res);
+                hits += GetHits(queries[i], res, K);
+            }
+        }
+        return (float) hits / (queries.size() * K);
+    }
+
     /**
      * 打印索引
      */
@@ -562,6 +1350,7 @@ namespace weavess {
      * @return 当前建造者指针
      */
     IndexBuilder *IndexBuilder::load_graph(TYPE type, char *graph_file) {
+        ClearQueryCache();
         std::ifstream in(graph_file, std::ios::binary);
         if (type == INDEX_NSG || type == INDEX_VAMANA) {
             in.read((char *)&final_index_->ep_, sizeof(unsigned));
@@ -582,5 +1371,178 @@ namespace weavess {
         return this;
     }
 
+    static const uint64_t DISK_INDEX_MAGIC = 0x3158444e49535657ULL;  // "WVSINDX1"
+
+    // 磁盘索引文件头，独占首个扇区
+    struct DiskIndexHeader {
+        uint64_t magic;
+        unsigned num;
+        unsigned dim;
+        unsigned max_degree;
+        unsigned entry;
+        unsigned node_size;
+        unsigned reserved;
+        uint64_t codes_offset;
+        uint64_t nodes_offset;
+    };
+
+    /**
+     * 保存磁盘索引：图与原始向量按结点块写入磁盘，结点块按扇区对齐，搜索时每个结点只需一次读取；
+     * 另存每维 SQ8 压缩向量，载入后常驻内存用于导航。需基础向量及 NSG/Vamana 图（构建结果或 load_graph 载入）
+     * @param type 图索引类型
+     * @param disk_file 磁盘索引保存地址
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::save_disk_index(TYPE type, char *disk_file) {
+        if (type != INDEX_NSG && type != INDEX_VAMANA) {
+            std::cerr << "disk index only supports NSG and VAMANA" << std::endl;
+            exit(-1);
+        }
+        const unsigned n = final_index_->getBaseLen();
+        const unsigned dim = final_index_->getBaseDim();
+        const float *data = final_index_->getBaseData();
+        if (data == nullptr) {
+            std::cerr << "disk index requires base data" << std::endl;
+            exit(-1);
+        }
+
+        // 图可来自构建结果或 load_graph
+        const bool from_final = !final_index_->getFinalGraph().empty();
+        if ((from_final ? final_index_->getFinalGraph().size() : final_index_->getLoadGraph().size()) != n) {
+            std::cerr << "graph size does not match base data" << std::endl;
+            exit(-1);
+        }
+        auto degree = [&](unsigned i) {
+            return (unsigned) (from_final ? final_index_->getFinalGraph()[i].size() : final_index_->getLoadGraph()[i].size());
+        };
+        auto neighbor = [&](unsigned i, unsigned j) {
+            return from_final ? final_index_->getFinalGraph()[i][j].id : final_index_->getLoadGraph()[i][j];
+        };
+        unsigned max_degree = 0;
+        for (unsigned i = 0; i < n; i++) max_degree = std::max(max_degree, degree(i));
+
+        // 每维最值训练 SQ8
+        std::vector<float> vmin(dim, std::numeric_limits<float>::max());
+        std::vector<float> vmax(dim, std::numeric_limits<float>::lowest());
+        for (size_t i = 0; i < n; i++) {
+            for (unsigned d = 0; d < dim; d++) {
+                vmin[d] = std::min(vmin[d], data[i * dim + d]);
+                vmax[d] = std::max(vmax[d], data[i * dim + d]);
+            }
+        }
+        std::vector<float> scale(dim);
+        for (unsigned d = 0; d < dim; d++) {
+            scale[d] = vmax[d] > vmin[d] ? (vmax[d] - vmin[d]) / 255 : 1;
+        }
+
+        const size_t sector = DISK::DISK_SECTOR_LEN;
+        DiskIndexHeader header{};
+        header.magic = DISK_INDEX_MAGIC;
+        header.num = n;
+        header.dim = dim;
+        header.max_degree = max_degree;
+        header.entry = final_index_->ep_;
+        header.node_size = (dim + 1 + max_degree) * sizeof(unsigned);
+        header.codes_offset = sector;
+        header.nodes_offset = (sector + 2 * dim * sizeof(float) + (size_t) n * dim + sector - 1) / sector * sector;
+
+        std::ofstream out(disk_file, std::ios::binary | std::ios::out);
+        if (!out.is_open()) {
+            std::cerr << "open file error" << std::endl;
+            exit(-1);
+        }
+        std::vector<char> block(sector, 0);
+        memcpy(block.data(), &header, sizeof(header));
+        out.write(block.data(), sector);
+
+        out.write((char *) vmin.data(), dim * sizeof(float));
+        out.write((char *) scale.data(), dim * sizeof(float));
+        std::vector<uint8_t> code(dim);
+        for (size_t i = 0; i < n; i++) {
+            for (unsigned d = 0; d < dim; d++) {
+                float c = std::round((data[i * dim + d] - vmin[d]) / scale[d]);
+                code[d] = (uint8_t) std::min(255.0f, std::max(0.0f, c));
+            }
+            out.write((char *) code.data(), dim);
+        }
+        block.assign(header.nodes_offset - (size_t) out.tellp(), 0);
+        out.write(block.data(), block.size());
+
+        // 结点块布局与 DISK::DiskNodeOffset 一致
+        final_index_->disk_node_size_ = header.node_size;
+        const unsigned per_block = final_index_->DiskNodesPerBlock();
+        block.resize(final_index_->DiskBlockSize());
+        for (unsigned begin = 0; begin < n; begin += per_block) {
+            std::fill(block.begin(), block.end(), 0);
+            for (unsigned i = begin; i < n && i < begin + per_block; i++) {
+                char *node = block.data() + (size_t) (i - begin) * header.node_size;
+                memcpy(node, data + (size_t) i * dim, dim * sizeof(float));
+                auto *links = (unsigned *) (node + dim * sizeof(float));
+                links[0] = degree(i);
+                for (unsigned j = 0; j < links[0]; j++) links[j + 1] = neighbor(i, j);
+            }
+            out.write(block.data(), block.size());
+        }
+        out.close();
+
+        std::cout << "disk index max degree : " << max_degree << ", node size : " << header.node_size << std::endl;
+        return this;
+    }
+
+    /**
+     * 载入磁盘索引：只读入压缩向量，图与原始向量留在磁盘上，由 ROUTER_DISK 按需读取
+     * @param disk_file 磁盘索引地址
+     * @return 当前建造者指针
+     */
+    IndexBuilder *IndexBuilder::load_disk_index(char *disk_file) {
+        ClearQueryCache();
+        int fd = open(disk_file, O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "open file error" << std::endl;
+            exit(-1);
+        }
+        DiskIndexHeader header{};
+        if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) || header.magic != DISK_INDEX_MAGIC) {
+            std::cerr << "not a disk index file" << std::endl;
+            exit(-1);
+        }
+        if (final_index_->getQueryData() != nullptr && final_index_->getQueryDim() != header.dim) {
+            std::cerr << "query dim does not match disk index" << std::endl;
+            exit(-1);
+        }
+
+        const unsigned dim = header.dim;
+        final_index_->disk_min_.resize(dim);
+        final_index_->disk_scale_.resize(dim);
+        final_index_->disk_codes_.resize((size_t) header.num * dim);
+        size_t offset = header.codes_offset;
+        auto read_all = [&](void *buf, size_t bytes) {
+            char *p = (char *) buf;
+            while (bytes > 0) {
+                ssize_t r = pread(fd, p, bytes, offset);
+                if (r <= 0) {
+                    std::cerr << "read disk index error" << std::endl;
+                    exit(-1);
+                }
+                p += r, bytes -= r, offset += r;
+            }
+        };
+        read_all(final_index_->disk_min_.data(), dim * sizeof(float));
+        read_all(final_index_->disk_scale_.data(), dim * sizeof(float));
+        read_all(final_index_->disk_codes_.data(), final_index_->disk_codes_.size());
+
+        if (final_index_->disk_fd_ >= 0) close(final_index_->disk_fd_);
+        final_index_->disk_fd_ = fd;
+        final_index_->disk_max_degree_ = header.max_degree;
+        final_index_->disk_entry_ = header.entry;
+        final_index_->disk_node_size_ = header.node_size;
+        final_index_->disk_nodes_offset_ = header.nodes_offset;
+        final_index_->setBaseLen(header.num);
+        final_index_->setBaseDim(dim);
+
+        std::cout << "disk index len : " << header.num << ", dim : " << dim << ", max degree : "
+                  << header.max_degree << std::endl;
+        return this;
+    }
 
 }
@@ -6,98 +6,191 @@
 
 namespace weavess {
 
-    // DFS
-    void ComponentConnNSGDFS::ConnInner() {
-        tree_grow();
+    /**
+     * 以 roots 为起点的并行层序 BFS，标记所有可达结点
+     *
+     * @param roots 起点
+     * @param visited 已标记的结点不再扩展
+     */
+    void ComponentConn::Reach(const std::vector<unsigned> &roots, Index::AtomicVisitedList &visited) {
+        std::vector<unsigned> frontier, next;
+        for (unsigned root : roots) {
+            if (visited.TryVisit(root)) frontier.push_back(root);
+        }
+        while (!frontier.empty()) {
+            next.clear();
+#pragma omp parallel
+            {
+                std::vector<unsigned> local;
+#pragma omp for schedule(dynamic, 64) nowait
+                for (unsigned i = 0; i < frontier.size(); i++) {
+                    for (const auto &nn : index->getFinalGraph()[frontier[i]]) {
+                        if (visited.TryVisit(nn.id)) local.push_back(nn.id);
+                    }
+                }
+#pragma omp critical
+                next.insert(next.end(), local.begin(), local.end());
+            }
+            frontier.swap(next);
+        }
     }
 
-    void ComponentConnNSGDFS::tree_grow() {
-        unsigned root = index->ep_;
-        boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
-        unsigned unlinked_cnt = 0;
-        while (unlinked_cnt < index->getBaseLen()) {
-            DFS(flags, root, unlinked_cnt);
-            // std::cout << unlinked_cnt << '\n';
-            if (unlinked_cnt >= index->getBaseLen()) break;
-            findroot(flags, root);
-            // std::cout << "new root"<<":"<<root << '\n';
-        }
-        for (size_t i = 0; i < index->getBaseLen(); ++i) {
-            if (index->getFinalGraph()[i].size() > index->width) {
-                index->width = index->getFinalGraph()[i].size();
+    /**
+     * 按 id 升序收集未标记的结点
+     */
+    void ComponentConn::Unreached(Index::AtomicVisitedList &visited, std::vector<unsigned> &unreached) {
+        std::vector<std::vector<unsigned>> locals(omp_get_max_threads());
+#pragma omp parallel
+        {
+            auto &local = locals[omp_get_thread_num()];
+#pragma omp for schedule(static)
+            for (unsigned i = 0; i < index->getBaseLen(); i++) {
+                if (!visited.Visited(i)) local.push_back(i);
             }
         }
+        // 静态调度下各线程负责连续区间，按线程号拼接即有序
+        unreached.clear();
+        for (auto &local : locals) unreached.insert(unreached.end(), local.begin(), local.end());
     }
 
-    void ComponentConnNSGDFS::DFS(boost::dynamic_bitset<> &flag, unsigned root, unsigned &cnt) {
-        unsigned tmp = root;
-        std::stack<unsigned> s;
-        s.push(root);
-        if (!flag[root]) cnt++;
-        flag[root] = true;
-        while (!s.empty()) {
-            unsigned next = index->getBaseLen() + 1;
-            for (unsigned i = 0; i < index->getFinalGraph()[tmp].size(); i++) {
-                if (!flag[index->getFinalGraph()[tmp][i].id]) {
-                    next = index->getFinalGraph()[tmp][i].id;
-                    break;
+    /**
+     * 为未达结点选取最少的新起点：在未达结点子图上做一遍 DFS，按完成时间逆序取尚未覆盖的结点作起点并向前覆盖，
+     * 取到的起点恰为子图强连通分量缩点后的各源点，连接这些起点即可使全部结点可达
+     *
+     * @param unreached 未达结点
+     * @param visited 返回时所有结点均已标记
+     * @param roots 新起点
+     * @param covered 非空时按覆盖顺序返回全部未达结点，每个起点之后紧跟由它覆盖的结点
+     */
+    void ComponentConn::CoverRoots(const std::vector<unsigned> &unreached, Index::AtomicVisitedList &visited,
+                                   std::vector<unsigned> &roots, std::vector<unsigned> *covered) {
+        const auto &graph = index->getFinalGraph();
+        boost::dynamic_bitset<> finished{index->getBaseLen(), 0};
+        std::vector<unsigned> order;
+        order.reserve(unreached.size());
+        std::vector<std::pair<unsigned, unsigned>> stack;
+
+        for (unsigned start : unreached) {
+            if (finished[start]) continue;
+            finished[start] = true;
+            stack.emplace_back(start, 0);
+            while (!stack.empty()) {
+                unsigned n = stack.back().first;
+                unsigned &e = stack.back().second;
+                if (e < graph[n].size()) {
+                    unsigned id = graph[n][e++].id;
+                    if (visited.Visited(id) || finished[id]) continue;
+                    finished[id] = true;
+                    stack.emplace_back(id, 0);
+                } else {
+                    order.push_back(n);
+                    stack.pop_back();
                 }
             }
-            // std::cout << next <<":"<<cnt <<":"<<tmp <<":"<<s.size()<< '\n';
-            if (next == (index->getBaseLen() + 1)) {
-                s.pop();
-                if (s.empty()) break;
-                tmp = s.top();
-                continue;
-            }
-            tmp = next;
-            flag[tmp] = true;
-            s.push(tmp);
-            cnt++;
         }
-    }
 
-    void ComponentConnNSGDFS::findroot(boost::dynamic_bitset<> &flag, unsigned &root) {
-        unsigned id = index->getBaseLen();
-        for (unsigned i = 0; i < index->getBaseLen(); i++) {
-            if (flag[i] == false) {
-                id = i;
-                break;
+        roots.clear();
+        if (covered) covered->clear();
+        std::vector<unsigned> queue;
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            if (!visited.TryVisit(*it)) continue;
+            roots.push_back(*it);
+            queue.assign(1, *it);
+            while (!queue.empty()) {
+                unsigned n = queue.back();
+                queue.pop_back();
+                if (covered) covered->push_back(n);
+                for (const auto &nn : graph[n]) {
+                    if (visited.TryVisit(nn.id)) queue.push_back(nn.id);
+                }
             }
         }
+    }
 
-        if (id == index->getBaseLen()) return;  // No Unlinked Node
+    // DFS
+    void ComponentConnNSGDFS::ConnInner() {
+        tree_grow();
+    }
 
-        std::vector<Index::Neighbor> tmp, pool;
-        get_neighbors(index->getBaseData() + index->getBaseDim() * id, tmp, pool);
-        std::sort(pool.begin(), pool.end());
+    /**
+     * 从 ep_ 并行 BFS 求可达结点，对未达结点一次选出全部新起点，并行搜索各起点的最近邻后批量连边；
+     * 第 k 个起点只挂到已达结点或前 k - 1 个起点覆盖的结点上，保证连边后全部可达
+     */
+    void ComponentConnNSGDFS::tree_grow() {
+        Index::AtomicVisitedList visited(index->getBaseLen());
+        Reach({index->ep_}, visited);
 
-        unsigned found = 0;
-        for (unsigned i = 0; i < pool.size(); i++) {
-            if (flag[pool[i].id]) {
-                // std::cout << pool[i].id << '\n';
-                root = pool[i].id;
+        std::vector<unsigned> unreached, roots, covered;
+        Unreached(visited, unreached);
+        if (!unreached.empty()) {
+            CoverRoots(unreached, visited, roots, &covered);
 
-                found = 1;
-                break;
+            // order[n]：已达结点为 0，第 k 个起点（从 0 计）覆盖的结点为 k + 1，第 k 个起点只能挂到 order 不超过 k 的结点上
+            std::vector<unsigned> order(index->getBaseLen(), 0);
+            for (unsigned i = 0, k = 0; i < covered.size(); i++) {
+                if (k < roots.size() && covered[i] == roots[k]) k++;
+                order[covered[i]] = k;
             }
-        }
-        if (found == 0) {
-            while (true) {
-                unsigned rid = rand() % index->getBaseLen();
-                if (flag[rid]) {
-                    root = rid;
-                    break;
+
+            std::vector<Index::SimpleNeighbor> links(roots.size());
+#pragma omp parallel
+            {
+                // 访问标记每个线程一份，按轮次复位，不随起点个数重复分配
+                Index::BuildScratch scratch(index->getBaseLen());
+                std::vector<Index::Neighbor> tmp, pool;
+#pragma omp for schedule(dynamic, 1)
+                for (unsigned i = 0; i < roots.size(); i++) {
+                    unsigned id = roots[i];
+                    tmp.clear();
+                    pool.clear();
+                    scratch.reset();
+                    get_neighbors(index->getBaseData() + index->getBaseDim() * (size_t) id, scratch, tmp, pool);
+                    std::sort(pool.begin(), pool.end());
+
+                    unsigned root = index->getBaseLen();
+                    for (unsigned j = 0; j < pool.size(); j++) {
+                        if (order[pool[j].id] <= i) {
+                            root = pool[j].id;
+                            break;
+                        }
+                    }
+                    if (root == index->getBaseLen()) {
+                        while (true) {
+                            unsigned rid = rand() % index->getBaseLen();
+                            if (order[rid] <= i) {
+                                root = rid;
+                                break;
+                            }
+                        }
+                    }
+                    float dist = index->getDist()->compare(index->getBaseData() + index->getBaseDim() * (size_t) root,
+                                                           index->getBaseData() + index->getBaseDim() * (size_t) id,
+                                                           index->getBaseDim());
+                    links[i] = Index::SimpleNeighbor(root, dist);
                 }
             }
+
+            for (unsigned i = 0; i < roots.size(); i++) {
+                index->getFinalGraph()[links[i].id].push_back(Index::SimpleNeighbor(roots[i], links[i].distance));
+            }
+        }
+
+        for (size_t i = 0; i < index->getBaseLen(); ++i) {
+            if (index->getFinalGraph()[i].size() > index->width) {
+                index->width = index->getFinalGraph()[i].size();
+            }
         }
-        float dist = index->getDist()->compare(index->getBaseData() + index->getBaseDim() * root,
-                                         index->getBaseData() + index->getBaseDim() * id,
-                                         index->getBaseDim());
-        index->getFinalGraph()[root].push_back(Index::SimpleNeighbor(id, dist));
     }
 
-    void ComponentConnNSGDFS::get_neighbors(const float *query, std::vector<Index::Neighbor> &retset,
+    /**
+     * 从 ep_ 的邻居及随机点出发贪婪搜索 query，经过的点计入 fullset
+     * @param query 查询向量
+     * @param scratch 访问标记，调用前已 reset
+     * @param retset 候选池
+     * @param fullset 经过的全部点
+     */
+    void ComponentConnNSGDFS::get_neighbors(const float *query, Index::BuildScratch &scratch,
+                                            std::vector<Index::Neighbor> &retset,
                                             std::vector<Index::Neighbor> &fullset) {
         unsigned L = index->getParam().get<unsigned>("L_nsg");
 
@@ -105,19 +198,18 @@ namespace weavess {
         std::vector<unsigned> init_ids(L);
         // initializer_->Search(query, nullptr, L, parameter, init_ids.data());
 
-        boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
         L = 0;
         for (unsigned i = 0; i < init_ids.size() && i < index->getFinalGraph()[index->ep_].size(); i++) {
             init_ids[i] = index->getFinalGraph()[index->ep_][i].id;
-            flags[init_ids[i]] = true;
+            scratch.mark(init_ids[i]);
             L++;
         }
         while (L < init_ids.size()) {
             unsigned id = rand() % index->getBaseLen();
-            if (flags[id]) continue;
+            if (scratch.visited(id)) continue;
             init_ids[L] = id;
             L++;
-            flags[id] = true;
+            scratch.mark(id);
         }
 
         L = 0;
@@ -143,8 +235,7 @@ namespace weavess {
 
                 for (unsigned m = 0; m < index->getFinalGraph()[n].size(); ++m) {
                     unsigned id = index->getFinalGraph()[n][m].id;
-                    if (flags[id]) continue;
-                    flags[id] = 1;
+                    if (scratch.check_and_mark(id)) continue;
 
                     float dist = index->getDist()->compare(query,
                                                            index->getBaseData() + index->getBaseDim() * (size_t) id,
@@ -165,7 +256,10 @@ namespace weavess {
         }
     }
 
-    // DFS EXPAND
+    /**
+     * DFS EXPAND : 依次从 n_try 个随机起点并行 BFS，未达结点选出最少的新起点，
+     * 挂到度数未满 range 的已达结点上；已达结点按 id 顺序用完后，再使用先前起点覆盖的结点
+     */
     void ComponentConnSSGDFS::ConnInner() {
         unsigned n_try = index->getParam().get<unsigned>("n_try");
         unsigned range = index->getParam().get<unsigned>("R_refine");
@@ -178,92 +272,107 @@ namespace weavess {
         for (unsigned i = 0; i < n_try; i++) {
             index->eps_.push_back(ids[i]);
         }
-#pragma omp parallel for
-        for(unsigned i=0; i<n_try; i++){
-            unsigned rootid = index->eps_[i];
-            boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
-            std::queue<unsigned> myqueue;
-            myqueue.push(rootid);
-            flags[rootid]=true;
-
-            std::vector<unsigned> uncheck_set(1);
-
-            while(uncheck_set.size() >0){
-                while(!myqueue.empty()){
-                    unsigned q_front=myqueue.front();
-                    myqueue.pop();
-
-                    for(unsigned j=0; j<index->getFinalGraph()[q_front].size(); j++){
-                        unsigned child = index->getFinalGraph()[q_front][j].id;
-                        if(flags[child])continue;
-                        flags[child] = true;
-                        myqueue.push(child);
-                    }
-                }
 
-                uncheck_set.clear();
-                for(unsigned j=0; j<index->getBaseLen(); j++){
-                    if(flags[j])continue;
-                    uncheck_set.push_back(j);
-                }
-                //std::cout <<i<<":"<< uncheck_set.size() << '\n';
-                if(uncheck_set.size()>0){
-                    for(unsigned j=0; j<index->getBaseLen(); j++){
-                        if(flags[j] && index->getFinalGraph()[j].size()<range){
-                            float dist = index->getDist()->compare(index->getBaseData() + index->getBaseDim() * j,
-                                                                   index->getBaseData() + index->getBaseDim() * uncheck_set[0],
-                                                                   index->getBaseDim());
-                            index->getFinalGraph()[j].push_back(Index::SimpleNeighbor(uncheck_set[0], dist));
-                            break;
-                        }
-                    }
-                    myqueue.push(uncheck_set[0]);
-                    flags[uncheck_set[0]]=true;
+        Index::AtomicVisitedList visited(index->getBaseLen());
+        std::vector<unsigned> unreached, roots;
+        for (unsigned i = 0; i < n_try; i++) {
+            visited.Reset();
+            Reach({index->eps_[i]}, visited);
+
+            Unreached(visited, unreached);
+            if (unreached.empty()) continue;
+
+            boost::dynamic_bitset<> reached{index->getBaseLen(), 0};
+            reached.set();
+            for (unsigned id : unreached) reached[id] = false;
+
+            std::vector<unsigned> parents;
+            for (unsigned j = 0; j < index->getBaseLen(); j++) {
+                if (reached[j]) parents.push_back(j);
+            }
+
+            std::vector<unsigned> covered;
+            CoverRoots(unreached, visited, roots, &covered);
+
+            size_t cursor = 0, pos = 0;
+            for (unsigned k = 0; k < roots.size(); k++) {
+                while (cursor < parents.size() && index->getFinalGraph()[parents[cursor]].size() >= range) cursor++;
+                if (cursor < parents.size()) {
+                    unsigned parent = parents[cursor];
+                    float dist = index->getDist()->compare(index->getBaseData() + index->getBaseDim() * (size_t) parent,
+                                                           index->getBaseData() + index->getBaseDim() * (size_t) roots[k],
+                                                           index->getBaseDim());
+                    index->getFinalGraph()[parent].push_back(Index::SimpleNeighbor(roots[k], dist));
                 }
+                // 该起点覆盖的结点已可达，可作为后续起点的挂载点
+                unsigned end = k + 1 < roots.size() ? roots[k + 1] : index->getBaseLen();
+                while (pos < covered.size() && covered[pos] != end) parents.push_back(covered[pos++]);
             }
         }
     }
 
-    // REVERSE
+    /**
+     * REVERSE : 反向边按目标结点分块收集到各线程的桶中，再按块并行并入邻居表，按距离排序去重
+     */
     void ComponentConnReverse::ConnInner() {
-        //ofstream os(hubs_path, ios::binary);
-        //vector <hub_pair > hubs;
-        std::vector<std::vector<Index::SimpleNeighbor>> rknn_graph;
-        rknn_graph.resize(index->getBaseLen());
+        struct ReverseEdge {
+            unsigned des;
+            Index::SimpleNeighbor nn;
+
+            bool operator<(const ReverseEdge &other) const {
+                if (des != other.des) return des < other.des;
+                return nn.id < other.nn.id;
+            }
+        };
 
-        int count = 0;
+        const unsigned block = 1024;
+        const unsigned bucket_num = (index->getBaseLen() + block - 1) / block;
+        std::vector<std::vector<std::vector<ReverseEdge>>> buckets(omp_get_max_threads());
 
-        for (unsigned i = 0; i < index->getBaseLen(); ++i)
+#pragma omp parallel
         {
-            auto const &knn = index->getFinalGraph()[i];
-            uint32_t K = index->getFinalGraph()[i].size(); //knn.size();
-            for (unsigned j = 0; j < K; j++)
-            {
-                rknn_graph[knn[j].id].push_back(Index::SimpleNeighbor(i, knn[j].distance));
+            auto &local = buckets[omp_get_thread_num()];
+            local.resize(bucket_num);
+#pragma omp for schedule(dynamic, 100)
+            for (unsigned i = 0; i < index->getBaseLen(); ++i) {
+                for (const auto &nn : index->getFinalGraph()[i]) {
+                    local[nn.id / block].push_back({nn.id, Index::SimpleNeighbor(i, nn.distance)});
+                }
             }
         }
 
-        for (unsigned i = 0; i < index->getBaseLen(); ++i)
+#pragma omp parallel
         {
-            std::vector<Index::SimpleNeighbor> rknn_list = rknn_graph[i];
-            count += rknn_list.size();
+            std::vector<ReverseEdge> edges;
+#pragma omp for schedule(dynamic)
+            for (unsigned b = 0; b < bucket_num; b++) {
+                edges.clear();
+                for (auto &local : buckets) {
+                    if (local.empty()) continue;
+                    edges.insert(edges.end(), local[b].begin(), local[b].end());
+                    std::vector<ReverseEdge>().swap(local[b]);
+                }
+                // 同一目标的反向边按源结点升序追加，排序结果与线程调度无关
+                std::sort(edges.begin(), edges.end());
 
-            for (unsigned j = 0; j < rknn_list.size(); ++j)
-            {
-                index->getFinalGraph()[i].push_back(rknn_list[j]);
-                //sum += exp(-1 * sqrt(rknn_list[j].dist) * beta); // a function with dist
-            }
+                for (size_t s = 0, e; s < edges.size(); s = e) {
+                    unsigned des = edges[s].des;
+                    auto &neighbors = index->getFinalGraph()[des];
+                    for (e = s; e < edges.size() && edges[e].des == des; e++) {
+                        neighbors.push_back(edges[e].nn);
+                    }
+                }
 
-            sort(index->getFinalGraph()[i].begin(), index->getFinalGraph()[i].end());
-            for (unsigned j = 1; j < index->getFinalGraph()[i].size(); ++j)
-            {
-                if (index->getFinalGraph()[i][j].id == index->getFinalGraph()[i][j - 1].id)
-                {
-                    index->getFinalGraph()[i].erase(index->getFinalGraph()[i].begin() + j);
-                    j--;
+                unsigned end = std::min(index->getBaseLen(), (b + 1) * block);
+                for (unsigned n = b * block; n < end; n++) {
+                    auto &neighbors = index->getFinalGraph()[n];
+                    std::sort(neighbors.begin(), neighbors.end());
+                    neighbors.erase(std::unique(neighbors.begin(), neighbors.end(),
+                                                [](const Index::SimpleNeighbor &a, const Index::SimpleNeighbor &b) {
+                                                    return a.id == b.id;
+                                                }), neighbors.end());
                 }
             }
         }
-        // fprintf(stderr, "inverse edges: %d\n", count);
     }
-}
\ No newline at end of file
+}
@@ -77,47 +77,76 @@ namespace weavess {
 
 
     /**
-     * 精确 KNNG
-     *
-     * KNNG 近邻个数 **等于** init_edges_num
+     * 分块暴力计算精确 KNNG：查询点按 query_block 行分块并行，每块依次扫过 base_block 行的基础数据块，
+     * 基础数据块在块内所有查询行间复用缓存，距离由 compare_block 成块计算，每行只维护容量为 K 的大顶堆
      *
+     * @param K 近邻个数（不含自身），N - 1 小于 K 时取 N - 1
+     * @param graph 输出，每行按距离升序
      */
-    void ComponentInitKNNG::InitInner() {
-        SetConfigs();
+    void ComponentInit::ExactKNNG(unsigned K, std::vector<std::vector<Index::SimpleNeighbor> > &graph) {
+        const unsigned N = index->getBaseLen();
+        const unsigned dim = index->getBaseDim();
+        const unsigned query_block = 64;
+        // 基础数据块约 128KB，留在 L2 中
+        const unsigned base_block = std::max(16u, (unsigned) (32768 / std::max(dim, 1u)));
+        K = std::min(K, N > 0 ? N - 1 : 0);
 
-        unsigned range = index->getInitEdgesNum();
-
-        index->getFinalGraph().resize(index->getBaseLen());
+        graph.resize(N);
 
 #ifdef PARALLEL
-#pragma omp parallel for num_threads(THREADS_NUM)
+#pragma omp parallel
 #endif
-        for (unsigned i = 0; i < index->getBaseLen(); i ++) {
-            index->getFinalGraph()[i].resize(range);
-
-            std::vector<Index::SimpleNeighbor> tmp;
-            tmp.resize(index->getBaseLen() - 1);
-
-            // 暴力计算 k 近邻
-            int pos = 0;
-            for (unsigned j = 0; j < index->getBaseLen(); j ++) {
-                if (i == j) continue;
+        {
+            std::vector<float> dists(base_block);
+            std::vector<std::vector<Index::SimpleNeighbor> > heaps(query_block);
+            for (auto &heap : heaps) heap.reserve(K);
+#ifdef PARALLEL
+#pragma omp for schedule(dynamic, 1)
+#endif
+            for (unsigned q0 = 0; q0 < N; q0 += query_block) {
+                const unsigned q_num = std::min(query_block, N - q0);
+                for (unsigned q = 0; q < q_num; q++) heaps[q].clear();
+
+                for (unsigned b0 = 0; b0 < N; b0 += base_block) {
+                    const unsigned b_num = std::min(base_block, N - b0);
+                    const float *base = index->getBaseData() + (size_t) b0 * dim;
+                    for (unsigned q = 0; q < q_num; q++) {
+                        const unsigned query = q0 + q;
+                        index->getDist()->compare_block(index->getBaseData() + (size_t) query * dim, base, b_num, dim,
+                                                        dists.data());
+                        auto &heap = heaps[q];
+                        for (unsigned b = 0; b < b_num; b++) {
+                            if (b0 + b == query) continue;
+                            if (heap.size() < K) {
+                                heap.emplace_back(b0 + b, dists[b]);
+                                std::push_heap(heap.begin(), heap.end());
+                            } else if (K > 0 && dists[b] < heap.front().distance) {
+                                std::pop_heap(heap.begin(), heap.end());
+                                heap.back() = Index::SimpleNeighbor(b0 + b, dists[b]);
+                                std::push_heap(heap.begin(), heap.end());
+                            }
+                        }
+                    }
+                }
 
-                float dist = index->getDist()->compare(index->getBaseData() + index->getBaseDim() * i,
-                                                       index->getBaseData() + index->getBaseDim() * j,
-                                                       index->getBaseDim());
-                tmp[pos ++] = Index::SimpleNeighbor(j, dist);
+                for (unsigned q = 0; q < q_num; q++) {
+                    std::sort_heap(heaps[q].begin(), heaps[q].end());
+                    graph[q0 + q].assign(heaps[q].begin(), heaps[q].end());
+                }
             }
+        }
+    }
 
-            std::sort(tmp.begin(), tmp.end());
-
-            for(int k = 0; k < index->getInitEdgesNum(); k ++) {
-                index->getFinalGraph()[i][k] = tmp[k];
-            }
+    /**
+     * 精确 KNNG
+     *
+     * KNNG 近邻个数 **等于** init_edges_num
+     *
+     */
+    void ComponentInitKNNG::InitInner() {
+        SetConfigs();
 
-            // 回收内存
-            std::vector<Index::SimpleNeighbor>().swap(tmp);
-        }
+        ExactKNNG(index->getInitEdgesNum(), index->getFinalGraph());
     }
 
     void ComponentInitKNNG::SetConfigs() {
@@ -127,71 +156,19 @@ namespace weavess {
 
 
 
-    // FANNG
+    /**
+     * FANNG : 精确 L 近邻
+     */
     void ComponentInitFANNG::InitInner() {
         SetConfigs();
 
-        init();
-
-        // graph_ -> final_graph
-        index->getFinalGraph().resize(index->getBaseLen());
-#ifdef PARALLEL
-#pragma omp parallel for
-#endif
-        for (unsigned i = 0; i < index->getBaseLen(); i++) {
-            std::vector<Index::SimpleNeighbor> tmp;
-
-            for (int j = 0; j < index->L; j++) {
-                tmp.push_back(Index::SimpleNeighbor(index->graph_[i].pool[j].id, index->graph_[i].pool[j].distance));
-            }
-
-//            for (auto &j : index->graph_[i].pool)
-//                tmp.push_back(Index::SimpleNeighbor(j.id, j.distance));
-
-            index->getFinalGraph()[i] = tmp;
-
-            // 内存释放
-            std::vector<Index::Neighbor>().swap(index->graph_[i].pool);
-            std::vector<unsigned>().swap(index->graph_[i].nn_new);
-            std::vector<unsigned>().swap(index->graph_[i].nn_old);
-            std::vector<unsigned>().swap(index->graph_[i].rnn_new);
-            std::vector<unsigned>().swap(index->graph_[i].rnn_new);
-        }
-
-        // 内存释放
-        std::vector<Index::nhood>().swap(index->graph_);
+        ExactKNNG(index->L, index->getFinalGraph());
     }
 
     void ComponentInitFANNG::SetConfigs() {
         index->L = index->getParam().get<unsigned>("L");
     }
 
-    void ComponentInitFANNG::init() {
-        index->graph_.resize(index->getBaseLen());
-#ifdef PARALLEL
-#pragma omp parallel for
-#endif
-        for (unsigned i = 0; i < index->getBaseLen(); i++) {
-            std::vector<Index::Neighbor> tmp;
-            for (unsigned j = 0; j < index->getBaseLen(); j++) {
-                if (i == j) continue;
-
-                float dist = index->getDist()->compare(index->getBaseData() + index->getBaseDim() * i,
-                                                       index->getBaseData() + index->getBaseDim() * j,
-                                                       index->getBaseDim());
-                tmp.emplace_back(Index::Neighbor(j, dist, true));
-            }
-            std::make_heap(tmp.begin(), tmp.end(), std::greater<Index::Neighbor>());
-            index->graph_[i].pool.reserve(index->L);
-            for (unsigned j = 0; j < index->L; j++) {
-                index->graph_[i].pool.emplace_back(tmp[0]);
-                std::pop_heap(tmp.begin(), tmp.end(), std::greater<Index::Neighbor>());
-                tmp.pop_back();
-            }
-        }
-    }
-
-
     // RAND
     void ComponentInitRand::InitInner() {
         SetConfigs();
@@ -250,6 +227,7 @@ namespace weavess {
     // KDT
     void ComponentInitKDT::InitInner() {
         SetConfigs();
+        index->nhood_locks_.resize(StripedLocks::StripesForThreads(index->n_threads_));
 
         unsigned seed = 1998;
 
@@ -642,7 +620,7 @@ namespace weavess {
                                                            index->getBaseDim());
 
                     {
-                        Index::LockGuard guard(index->graph_[tmpfea].lock);
+                        Index::LockGuard guard(index->nhood_locks_[tmpfea]);
                         if (index->knn_graph[tmpfea].size() < K || dist < index->knn_graph[tmpfea].begin()->distance) {
                             Index::Candidate c1(feature_id, dist);
                             index->knn_graph[tmpfea].insert(c1);
@@ -652,7 +630,7 @@ namespace weavess {
                     }
 
                     {
-                        Index::LockGuard guard(index->graph_[feature_id].lock);
+                        Index::LockGuard guard(index->nhood_locks_[feature_id]);
                         if (index->knn_graph[feature_id].size() < K ||
                             dist < index->knn_graph[feature_id].begin()->distance) {
                             Index::Candidate c1(tmpfea, dist);
@@ -878,18 +856,14 @@ namespace weavess {
     void ComponentInitNSW::InitInner() {
         SetConfigs();
 
-        index->nodes_.resize(index->getBaseLen());
-        Index::HnswNode *first = new Index::HnswNode(0, 0, index->NN_, index->NN_);
-        index->nodes_[0] = first;
-        index->enterpoint_ = first;
+        index->nsw_links_.assign(index->getBaseLen(), std::vector<unsigned>());
+        index->link_locks_.resize(StripedLocks::StripesForThreads(index->n_threads_));
 #pragma omp parallel num_threads(index->n_threads_)
         {
             auto *visited_list = new Index::VisitedList(index->getBaseLen());
 #pragma omp for schedule(dynamic, 128)
             for (size_t i = 1; i < index->getBaseLen(); ++i) {
-                auto *qnode = new Index::HnswNode(i, 0, index->NN_, index->NN_);
-                index->nodes_[i] = qnode;
-                InsertNode(qnode, visited_list);
+                InsertNode(i, visited_list);
             }
             delete visited_list;
         }
@@ -901,63 +875,53 @@ namespace weavess {
         index->n_threads_ = index->getParam().get<unsigned>("n_threads_");
     }
 
-    void ComponentInitNSW::InsertNode(Index::HnswNode *qnode, Index::VisitedList *visited_list) {
-        Index::HnswNode *enterpoint = index->enterpoint_;
-
-        std::priority_queue<Index::FurtherFirst> result;
-        std::priority_queue<Index::CloserFirst> tmp;
+    void ComponentInitNSW::InsertNode(unsigned qnode, Index::VisitedList *visited_list) {
+        std::priority_queue<std::pair<float, unsigned>> result;
 
         // CANDIDATE
-        SearchAtLayer(qnode, enterpoint, 0, visited_list, result);
+        SearchAtLayer(qnode, 0, visited_list, result);
 
+        while (result.size() > index->NN_) result.pop();
         while (!result.empty()) {
-            tmp.push(Index::CloserFirst(result.top().GetNode(), result.top().GetDistance()));
+            Link(result.top().second, qnode);
+            Link(qnode, result.top().second);
             result.pop();
         }
-
-        int pos = 0;
-        while (!tmp.empty() && pos < index->NN_) {
-            auto *top_node = tmp.top().GetNode();
-            tmp.pop();
-            Link(top_node, qnode, 0);
-            pos++;
-        }
     }
 
-    void ComponentInitNSW::SearchAtLayer(Index::HnswNode *qnode, Index::HnswNode *enterpoint, int level,
-                                         Index::VisitedList *visited_list,
-                                         std::priority_queue<Index::FurtherFirst> &result) {
-        // TODO: check Node 12bytes => 8bytes
-        std::priority_queue<Index::CloserFirst> candidates;
-        float d = index->getDist()->compare(index->getBaseData() + qnode->GetId() * index->getBaseDim(),
-                                            index->getBaseData() + enterpoint->GetId() * index->getBaseDim(),
+    void ComponentInitNSW::SearchAtLayer(unsigned qnode, unsigned enterpoint, Index::VisitedList *visited_list,
+                                         std::priority_queue<std::pair<float, unsigned>> &result) {
+        typedef std::pair<float, unsigned> DistId;
+        std::priority_queue<DistId, std::vector<DistId>, std::greater<DistId>> candidates;
+        std::vector<unsigned> neighbors;
+        const float *query = index->getBaseData() + (size_t) qnode * index->getBaseDim();
+
+        float d = index->getDist()->compare(query, index->getBaseData() + (size_t) enterpoint * index->getBaseDim(),
                                             index->getBaseDim());
-        result.emplace(enterpoint, d);
-        candidates.emplace(enterpoint, d);
+        result.emplace(d, enterpoint);
+        candidates.emplace(d, enterpoint);
 
         visited_list->Reset();
-        visited_list->MarkAsVisited(enterpoint->GetId());
+        visited_list->MarkAsVisited(enterpoint);
 
         while (!candidates.empty()) {
-            const Index::CloserFirst &candidate = candidates.top();
-            float lower_bound = result.top().GetDistance();
-            if (candidate.GetDistance() > lower_bound)
+            DistId candidate = candidates.top();
+            if (candidate.first > result.top().first)
                 break;
-
-            Index::HnswNode *candidate_node = candidate.GetNode();
-            std::unique_lock<std::mutex> lock(candidate_node->GetAccessGuard());
-            const std::vector<Index::HnswNode *> &neighbors = candidate_node->GetFriends(level);
             candidates.pop();
-            for (const auto &neighbor : neighbors) {
-                int id = neighbor->GetId();
+
+            {
+                std::lock_guard<std::mutex> guard(index->link_locks_[candidate.second]);
+                neighbors = index->nsw_links_[candidate.second];
+            }
+            for (unsigned id : neighbors) {
                 if (visited_list->NotVisited(id)) {
                     visited_list->MarkAsVisited(id);
-                    d = index->getDist()->compare(index->getBaseData() + qnode->GetId() * index->getBaseDim(),
-                                                  index->getBaseData() + neighbor->GetId() * index->getBaseDim(),
+                    d = index->getDist()->compare(query, index->getBaseData() + (size_t) id * index->getBaseDim(),
                                                   index->getBaseDim());
-                    if (result.size() < index->ef_construction_ || result.top().GetDistance() > d) {
-                        result.emplace(neighbor, d);
-                        candidates.emplace(neighbor, d);
+                    if (result.size() < index->ef_construction_ || result.top().first > d) {
+                        result.emplace(d, id);
+                        candidates.emplace(d, id);
                         if (result.size() > index->ef_construction_)
                             result.pop();
                     }
@@ -966,9 +930,13 @@ namespace weavess {
         }
     }
 
-    void ComponentInitNSW::Link(Index::HnswNode *source, Index::HnswNode *target, int level) {
-        source->AddFriends(target, true);
-        target->AddFriends(source, true);
+    void ComponentInitNSW::Link(unsigned source, unsigned target) {
+        std::lock_guard<std::mutex> guard(index->link_locks_[source]);
+        std::vector<unsigned> &neighbors = index->nsw_links_[source];
+        auto it = std::lower_bound(neighbors.begin(), neighbors.end(), target);
+        if (it == neighbors.end() || *it != target) {
+            neighbors.insert(it, target);
+        }
     }
 
 
@@ -977,18 +945,6 @@ namespace weavess {
         SetConfigs();
 
         Build(false);
-
-//        for(int i = 0; i < index->nodes_.size(); i ++) {
-//            std::cout << "node id : " << i << std::endl;
-//            std::cout << "node level : " << index->nodes_[i]->GetLevel() << std::endl;
-//            for(int level = index->nodes_[i]->GetLevel(); level >= 0; level --) {
-//                std::cout << "level : " << level << std::endl;
-//                for(int j = 0; j < index->nodes_[i]->GetFriends(level).size(); j ++) {
-//                    std::cout << index->nodes_[i]->GetFriends(level)[j]->GetId() << " ";
-//                }
-//                std::cout << std::endl;
-//            }
-//        }
     }
 
     void ComponentInitHNSW::SetConfigs() {
@@ -1002,24 +958,43 @@ namespace weavess {
         index->level_mult_ = index->mult > 0 ? index->mult : (1 / log(1.0 * index->m_));
     }
 
+    /**
+     * 预先决定各结点层数，据此一次性分配分层邻接表（第 0 层定长，上层按层数紧凑排布），
+     * 插入直接在其上进行，结点修改由条带锁串行化
+     */
     void ComponentInitHNSW::Build(bool reverse) {
-        index->nodes_.resize(index->getBaseLen());
-        // 随机决定当前结点层数
-        int level = GetRandomNodeLevel();
+        const unsigned n = index->getBaseLen();
+
+        std::vector<int> levels(n);
+        for (unsigned i = 0; i < n; i++) {
+            levels[i] = GetRandomNodeLevel();
+        }
+
+        index->frozen_m0_ = index->max_m0_;
+        index->frozen_m_ = index->max_m_;
+        index->upper_offset_.resize(n);
+        size_t upper_size = 0;
+        for (unsigned i = 0; i < n; i++) {
+            index->upper_offset_[i] = upper_size;
+            upper_size += (size_t) levels[i] * (index->max_m_ + 1);
+        }
+        index->level0_links_.assign((size_t) n * (index->max_m0_ + 1), 0);
+        index->upper_links_.assign(upper_size, 0);
+        index->link_locks_.resize(StripedLocks::StripesForThreads(index->n_threads_));
+
         // 必须提前插入结点
-        auto *first = new Index::HnswNode(0, level, index->max_m_, index->max_m0_);
-        index->nodes_[0] = first;
-        index->max_level_ = level;
-        index->enterpoint_ = first;
+        index->max_level_ = levels[0];
+        index->frozen_enterpoint_ = 0;
+
+        // PRUNE
+        prune_.reset(new ComponentPruneHeuristic(index));
+
 #pragma omp parallel num_threads(index->n_threads_)
         {
-            auto *visited_list = new Index::VisitedList(index->getBaseLen());
+            auto *visited_list = new Index::VisitedList(n);
 #pragma omp for schedule(dynamic, 128)
-            for (size_t i = 1; i < index->getBaseLen(); ++i) {
-                int level = GetRandomNodeLevel();
-                auto *qnode = new Index::HnswNode(i, level, index->max_m_, index->max_m0_);
-                index->nodes_[i] = qnode;
-                InsertNode(qnode, visited_list);
+            for (size_t i = 1; i < n; ++i) {
+                InsertNode(i, levels[i], visited_list);
             }
 
             delete visited_list;
@@ -1044,138 +1019,150 @@ namespace weavess {
         return (int) (-log(r) * index->level_mult_);
     }
 
-    void ComponentInitHNSW::InsertNode(Index::HnswNode *qnode, Index::VisitedList *visited_list) {
-        int cur_level = qnode->GetLevel();
+    unsigned *ComponentInitHNSW::GetLinks(unsigned id, int level) {
+        if (level == 0) return &index->level0_links_[(size_t) id * (index->frozen_m0_ + 1)];
+        return &index->upper_links_[index->upper_offset_[id] + (size_t) (level - 1) * (index->frozen_m_ + 1)];
+    }
+
+    // 在锁保护下复制结点的邻居
+    void ComponentInitHNSW::CopyLinks(unsigned id, int level, std::vector<unsigned> &links) {
+        const unsigned *src = GetLinks(id, level);
+        std::lock_guard<std::mutex> guard(index->link_locks_[id]);
+        links.assign(src + 1, src + 1 + src[0]);
+    }
+
+    void ComponentInitHNSW::InsertNode(unsigned qnode, int level, Index::VisitedList *visited_list) {
+        int cur_level = level;
         std::unique_lock<std::mutex> max_level_lock(index->max_level_guard_, std::defer_lock);
         if (cur_level > index->max_level_)
             max_level_lock.lock();
 
         int max_level_copy = index->max_level_;
-        Index::HnswNode *enterpoint = index->enterpoint_;
+        unsigned enterpoint = index->frozen_enterpoint_;
+        const float *query = index->getBaseData() + (size_t) qnode * index->getBaseDim();
+        std::vector<unsigned> neighbors;
 
         // 当前结点所达层数小于最大层数，逐步向下寻找
         if (cur_level < max_level_copy) {
-            Index::HnswNode *cur_node = enterpoint;
-
-            float d = index->getDist()->compare(index->getBaseData() + qnode->GetId() * index->getBaseDim(),
-                                                index->getBaseData() + cur_node->GetId() * index->getBaseDim(),
-                                                index->getBaseDim());
-            float cur_dist = d;
+            float cur_dist = index->getDist()->compare(query,
+                                                       index->getBaseData() + (size_t) enterpoint * index->getBaseDim(),
+                                                       index->getBaseDim());
             for (auto i = max_level_copy; i > cur_level; --i) {
                 bool changed = true;
                 while (changed) {
                     changed = false;
-                    std::unique_lock<std::mutex> local_lock(cur_node->GetAccessGuard());
-                    const std::vector<Index::HnswNode *> &neighbors = cur_node->GetFriends(i);
+                    CopyLinks(enterpoint, i, neighbors);
 
-                    for (auto iter = neighbors.begin(); iter != neighbors.end(); ++iter) {
-                        d = index->getDist()->compare(index->getBaseData() + qnode->GetId() * index->getBaseDim(),
-                                                      index->getBaseData() + (*iter)->GetId() * index->getBaseDim(),
-                                                      index->getBaseDim());
+                    for (unsigned id : neighbors) {
+                        float d = index->getDist()->compare(query,
+                                                            index->getBaseData() + (size_t) id * index->getBaseDim(),
+                                                            index->getBaseDim());
 
                         if (d < cur_dist) {
                             cur_dist = d;
-                            cur_node = *iter;
+                            enterpoint = id;
                             changed = true;
                         }
                     }
                 }
             }
-            enterpoint = cur_node;
         }
 
-        // PRUNE
-        ComponentPrune *a = new ComponentPruneHeuristic(index);
-
+        std::vector<Index::SimpleNeighbor> result;
         for (auto i = std::min(max_level_copy, cur_level); i >= 0; --i) {
-            std::priority_queue<Index::FurtherFirst> result;
             // 贪婪算法在当前层获取近邻候选点
             SearchAtLayer(qnode, enterpoint, i, visited_list, result);
 
-            a->Hnsw2Neighbor(qnode->GetId(), index->m_, result);
+            prune_->PruneToRange(index->m_, result);
 
-            while (!result.empty()) {
-                auto *top_node = result.top().GetNode();
-                result.pop();
-                Link(top_node, qnode, i);
-                Link(qnode, top_node, i);
+            for (const auto &nn : result) {
+                Link(nn.id, qnode, i);
+                Link(qnode, nn.id, i);
             }
         }
-        if (cur_level > index->enterpoint_->GetLevel()) {
-            index->enterpoint_ = qnode;
+        if (cur_level > index->max_level_) {
+            index->frozen_enterpoint_ = qnode;
             index->max_level_ = cur_level;
         }
     }
 
-    void ComponentInitHNSW::SearchAtLayer(Index::HnswNode *qnode, Index::HnswNode *enterpoint, int level,
+    /**
+     * 在指定层做 ef_construction 搜索
+     * @param result 候选点，按距离升序
+     */
+    void ComponentInitHNSW::SearchAtLayer(unsigned qnode, unsigned enterpoint, int level,
                                           Index::VisitedList *visited_list,
-                                          std::priority_queue<Index::FurtherFirst> &result) {
-        // TODO: check Node 12bytes => 8bytes
-        std::priority_queue<Index::CloserFirst> candidates;
-        float d = index->getDist()->compare(index->getBaseData() + qnode->GetId() * index->getBaseDim(),
-                                            index->getBaseData() + enterpoint->GetId() * index->getBaseDim(),
+                                          std::vector<Index::SimpleNeighbor> &result) {
+        typedef std::pair<float, unsigned> DistId;
+        std::priority_queue<DistId> top;
+        std::priority_queue<DistId, std::vector<DistId>, std::greater<DistId>> candidates;
+        std::vector<unsigned> neighbors;
+        const float *query = index->getBaseData() + (size_t) qnode * index->getBaseDim();
+
+        float d = index->getDist()->compare(query, index->getBaseData() + (size_t) enterpoint * index->getBaseDim(),
                                             index->getBaseDim());
-        result.emplace(enterpoint, d);
-        candidates.emplace(enterpoint, d);
+        top.emplace(d, enterpoint);
+        candidates.emplace(d, enterpoint);
 
         visited_list->Reset();
-        visited_list->MarkAsVisited(enterpoint->GetId());
+        visited_list->MarkAsVisited(enterpoint);
 
         while (!candidates.empty()) {
-            const Index::CloserFirst &candidate = candidates.top();
-            float lower_bound = result.top().GetDistance();
-            if (candidate.GetDistance() > lower_bound)
+            DistId candidate = candidates.top();
+            if (candidate.first > top.top().first)
                 break;
-
-            Index::HnswNode *candidate_node = candidate.GetNode();
-            std::unique_lock<std::mutex> lock(candidate_node->GetAccessGuard());
-            const std::vector<Index::HnswNode *> &neighbors = candidate_node->GetFriends(level);
             candidates.pop();
 
-            for (const auto &neighbor : neighbors) {
-                int id = neighbor->GetId();
+            CopyLinks(candidate.second, level, neighbors);
+            for (unsigned id : neighbors) {
                 if (visited_list->NotVisited(id)) {
                     visited_list->MarkAsVisited(id);
-                    d = index->getDist()->compare(index->getBaseData() + qnode->GetId() * index->getBaseDim(),
-                                                  index->getBaseData() + neighbor->GetId() * index->getBaseDim(),
+                    d = index->getDist()->compare(query, index->getBaseData() + (size_t) id * index->getBaseDim(),
                                                   index->getBaseDim());
-                    if (result.size() < index->ef_construction_ || result.top().GetDistance() > d) {
-                        result.emplace(neighbor, d);
-                        candidates.emplace(neighbor, d);
-                        if (result.size() > index->ef_construction_)
-                            result.pop();
+                    if (top.size() < index->ef_construction_ || top.top().first > d) {
+                        top.emplace(d, id);
+                        candidates.emplace(d, id);
+                        if (top.size() > index->ef_construction_)
+                            top.pop();
                     }
                 }
             }
         }
+
+        result.resize(top.size());
+        for (int i = (int) top.size() - 1; i >= 0; i--) {
+            result[i] = Index::SimpleNeighbor(top.top().second, top.top().first);
+            top.pop();
+        }
     }
 
-    void ComponentInitHNSW::Link(Index::HnswNode *source, Index::HnswNode *target, int level) {
-        std::unique_lock<std::mutex> lock(source->GetAccessGuard());
-        std::vector<Index::HnswNode *> &neighbors = source->GetFriends(level);
-        neighbors.push_back(target);
-        bool shrink = (level > 0 && neighbors.size() > source->GetMaxM()) ||
-                      (level <= 0 && neighbors.size() > source->GetMaxM0());
-        if (!shrink) return;
+    void ComponentInitHNSW::Link(unsigned source, unsigned target, int level) {
+        std::lock_guard<std::mutex> guard(index->link_locks_[source]);
+        unsigned *links = GetLinks(source, level);
+        const unsigned max_m = level > 0 ? index->max_m_ : index->max_m0_;
+        if (links[0] < max_m) {
+            links[++links[0]] = target;
+            return;
+        }
 
-        std::priority_queue<Index::FurtherFirst> tempres;
-        for (const auto &neighbor : neighbors) {
-            float tmp = index->getDist()->compare(index->getBaseData() + source->GetId() * index->getBaseDim(),
-                                                  index->getBaseData() + neighbor->GetId() * index->getBaseDim(),
-                                                  index->getBaseDim());
-            tempres.push(Index::FurtherFirst(neighbor, tmp));
+        // 邻居已满，连同新邻居一起按启发式裁剪
+        const float *source_data = index->getBaseData() + (size_t) source * index->getBaseDim();
+        std::vector<Index::SimpleNeighbor> pool;
+        pool.reserve(links[0] + 1);
+        for (unsigned j = 0; j <= links[0]; j++) {
+            unsigned id = j < links[0] ? links[j + 1] : target;
+            float d = index->getDist()->compare(source_data, index->getBaseData() + (size_t) id * index->getBaseDim(),
+                                                index->getBaseDim());
+            pool.emplace_back(id, d);
         }
+        std::sort(pool.begin(), pool.end());
 
-        // PRUNE
-        ComponentPrune *a = new ComponentPruneHeuristic(index);
-        a->Hnsw2Neighbor(source->GetId(), tempres.size() - 1, tempres);
+        prune_->PruneToRange(max_m, pool);
 
-        neighbors.clear();
-        while (!tempres.empty()) {
-            neighbors.emplace_back(tempres.top().GetNode());
-            tempres.pop();
+        links[0] = pool.size();
+        for (size_t j = 0; j < pool.size(); j++) {
+            links[j + 1] = pool[j].id;
         }
-        std::priority_queue<Index::FurtherFirst>().swap(tempres);
     }
 
 
@@ -77,6 +77,18 @@ namespace weavess {
 
         assert(index->getBaseData() != nullptr && index->getBaseLen() != 0 && index->getBaseDim() != 0);
 
+        LoadQueryInner(query_file, ground_file, parameters);
+
+        assert(index->getBaseDim() == index->getQueryDim());
+    }
+
+    /**
+     * 仅加载查询集、真值及参数，用于基础向量不驻留内存的场景（如磁盘索引）
+     * @param query_file *_query.fvecs
+     * @param ground_file *_groundtruth.ivecs
+     * @param parameters 参数
+     */
+    void ComponentLoad::LoadQueryInner(char *query_file, char *ground_file, Parameters &parameters) {
         // query_data
         float *query_data = nullptr;
         unsigned query_num{};
@@ -87,7 +99,6 @@ namespace weavess {
         index->setQueryDim(query_dim);
 
         assert(index->getQueryData() != nullptr && index->getQueryLen() != 0 && index->getQueryDim() != 0);
-        assert(index->getBaseDim() == index->getQueryDim());
 
         // ground_data
         unsigned *ground_data = nullptr;
@@ -102,4 +113,21 @@ namespace weavess {
 
         index->setParam(parameters);
     }
+
+    /**
+     * 加载标签列，每个基础向量一个标签，顺序与基础向量一致
+     * @param label_file *.ivecs，维度为 1
+     */
+    void ComponentLoad::LoadLabelsInner(char *label_file) {
+        unsigned *labels = nullptr;
+        unsigned num{};
+        unsigned dim{};
+        load_data<unsigned>(label_file, labels, num, dim);
+        if (dim != 1 || num != index->getBaseLen()) {
+            std::cerr << "label file must hold one label per base vector" << std::endl;
+            exit(-1);
+        }
+        index->getLabels().assign(labels, labels + num);
+        delete[] labels;
+    }
 }
\ No newline at end of file
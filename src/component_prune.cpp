@@ -5,9 +5,8 @@
 #include "weavess/component.h"
 
 namespace weavess {
-    void ComponentPruneNaive::PruneInner(unsigned query, unsigned range, boost::dynamic_bitset<> flags,
-                                         std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) {
-        Index::SimpleNeighbor *des_pool = cut_graph_ + (size_t) query * (size_t) range;
+    void ComponentPruneNaive::PruneInner(unsigned query, unsigned range, Index::BuildScratch &scratch,
+                                         std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) {
         for (size_t t = 0; t < (pool.size() > range ? range : pool.size()); t++) {
             des_pool[t].id = pool[t].id;
             des_pool[t].distance = pool[t].distance;
@@ -17,15 +16,15 @@ namespace weavess {
         }
     }
 
-    void ComponentPruneNSG::PruneInner(unsigned query, unsigned range, boost::dynamic_bitset<> flags,
-                                       std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) {
+    void ComponentPruneNSG::PruneInner(unsigned query, unsigned range, Index::BuildScratch &scratch,
+                                       std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) {
         unsigned maxc = index->C_refine;
 
         unsigned start = 0;
 
         for (unsigned nn = 0; nn < index->getFinalGraph()[query].size(); nn++) {
             unsigned id = index->getFinalGraph()[query][nn].id;
-            if (flags[id]) continue;
+            if (scratch.visited(id)) continue;
             float dist =
                     index->getDist()->compare(index->getBaseData() + index->getBaseDim() * (size_t) query,
                                               index->getBaseData() + index->getBaseDim() * (size_t) id,
@@ -34,7 +33,8 @@ namespace weavess {
         }
 
         std::sort(pool.begin(), pool.end());
-        std::vector<Index::SimpleNeighbor> result;
+        std::vector<Index::SimpleNeighbor> &result = scratch.result;
+        result.clear();
         if (pool[start].id == query) start++;
         result.push_back(pool[start]);
 
@@ -58,7 +58,6 @@ namespace weavess {
             if (!occlude) result.push_back(p);
         }
 
-        Index::SimpleNeighbor *des_pool = cut_graph_ + (size_t) query * (size_t) range;
         for (size_t t = 0; t < result.size(); t++) {
             des_pool[t].id = result[t].id;
             des_pool[t].distance = result[t].distance;
@@ -68,13 +67,13 @@ namespace weavess {
         }
     }
 
-    void ComponentPruneSSG::PruneInner(unsigned query, unsigned range, boost::dynamic_bitset<> flags,
-                                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) {
+    void ComponentPruneSSG::PruneInner(unsigned query, unsigned range, Index::BuildScratch &scratch,
+                                        std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) {
         unsigned start = 0;
 
         for (unsigned nn = 0; nn < index->getFinalGraph()[query].size(); nn++) {
             unsigned id = index->getFinalGraph()[query][nn].id;
-            if (flags[id]) continue;
+            if (scratch.visited(id)) continue;
             float dist = index->getDist()->compare(index->getBaseData() + index->getBaseDim() * (size_t)query,
                                                    index->getBaseData() + index->getBaseDim() * (size_t)id,
                                                    (unsigned)index->getBaseDim());
@@ -82,7 +81,8 @@ namespace weavess {
         }
 
         std::sort(pool.begin(), pool.end());
-        std::vector<Index::SimpleNeighbor> result;
+        std::vector<Index::SimpleNeighbor> &result = scratch.result;
+        result.clear();
         if (pool[start].id == query) start++;
         result.push_back(pool[start]);
 
@@ -111,7 +111,6 @@ namespace weavess {
             if (!occlude) result.push_back(p);
         }
 
-        Index::SimpleNeighbor *des_pool = cut_graph_ + (size_t)query * (size_t)range;
         for (size_t t = 0; t < result.size(); t++) {
             des_pool[t].id = result[t].id;
             des_pool[t].distance = result[t].distance;
@@ -121,8 +120,8 @@ namespace weavess {
         }
     }
 
-    void ComponentPruneDPG::PruneInner(unsigned query, unsigned int range, boost::dynamic_bitset<> flags,
-                                       std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) {
+    void ComponentPruneDPG::PruneInner(unsigned query, unsigned int range, Index::BuildScratch &scratch,
+                                       std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) {
 
         int len = pool.size();
         if(len > 2 * range)
@@ -162,7 +161,8 @@ namespace weavess {
 
         int cut = tmp_hit[range];
 
-        std::vector<Index::SimpleNeighbor> result;
+        std::vector<Index::SimpleNeighbor> &result = scratch.result;
+        result.clear();
 
         for(int i = 0; i < len; i ++){
             if(hit[i] <= cut)
@@ -171,7 +171,6 @@ namespace weavess {
 
         result.resize(range);
 
-        Index::SimpleNeighbor *des_pool = cut_graph_ + (size_t)query * (size_t)range;
         //std::cout << "prune : " << result.size() << "len : " << len << std::endl;
         for (size_t t = 0; t < result.size(); t++) {
             des_pool[t].id = result[t].id;
@@ -185,10 +184,11 @@ namespace weavess {
         std::vector<int>().swap(hit);
     }
 
-    void ComponentPruneHeuristic::PruneInner(unsigned query, unsigned int range, boost::dynamic_bitset<> flags,
-                                             std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) {
+    void ComponentPruneHeuristic::PruneInner(unsigned query, unsigned int range, Index::BuildScratch &scratch,
+                                             std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) {
 
-        std::vector<Index::SimpleNeighbor> picked;
+        std::vector<Index::SimpleNeighbor> &picked = scratch.result;
+        picked.clear();
         if(pool.size() > range){
 //            std::sort(pool.begin(), pool.end());
             Index::MinHeap<float, Index::SimpleNeighbor> skipped;
@@ -226,7 +226,6 @@ namespace weavess {
                 picked.push_back(pool[i]);
             }
         }
-        Index::SimpleNeighbor *des_pool = cut_graph_ + (size_t)query * (size_t)range;
         //std::cout << "pick : " << picked.size() << std::endl;
         for (size_t t = 0; t < picked.size(); t++) {
             des_pool[t].id = picked[t].id;
@@ -238,13 +237,12 @@ namespace weavess {
         if (picked.size() < range) {
             des_pool[picked.size()].distance = -1;
         }
-
-        std::vector<Index::SimpleNeighbor>().swap(picked);
     }
 
-    void ComponentPruneVAMANA::PruneInner(unsigned query, unsigned int range, boost::dynamic_bitset<> flags,
-                                          std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) {
-        std::vector<Index::SimpleNeighbor> picked;
+    void ComponentPruneVAMANA::PruneInner(unsigned query, unsigned int range, Index::BuildScratch &scratch,
+                                          std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) {
+        std::vector<Index::SimpleNeighbor> &picked = scratch.result;
+        picked.clear();
         if(pool.size() > range){
             std::sort(pool.begin(), pool.end());
 
@@ -283,7 +281,6 @@ namespace weavess {
                 picked.push_back(pool[i]);
             }
         }
-        Index::SimpleNeighbor *des_pool = cut_graph_ + (size_t)query * (size_t)range;
         //std::cout << "pick : " << picked.size() << std::endl;
         for (size_t t = 0; t < picked.size(); t++) {
             des_pool[t].id = picked[t].id;
@@ -295,16 +292,12 @@ namespace weavess {
         if (picked.size() < range) {
             des_pool[picked.size()].distance = -1;
         }
-
-        std::vector<Index::SimpleNeighbor>().swap(picked);
     }
 
-    void ComponentPruneRNG::PruneInner(unsigned int query, unsigned int range, boost::dynamic_bitset<> flags,
-                                       std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *cut_graph_) {
+    void ComponentPruneRNG::PruneInner(unsigned int query, unsigned int range, Index::BuildScratch &scratch,
+                                       std::vector<Index::SimpleNeighbor> &pool, Index::SimpleNeighbor *des_pool) {
         unsigned count = 0;
 
-        Index::SimpleNeighbor *des_pool = cut_graph_ + (size_t) query * (size_t) range;
-
         for(int j = 0; j < index->getFinalGraph()[query].size() && j < range; j ++) {
             des_pool[j].id = index->getFinalGraph()[query][j].id;
             des_pool[j].distance = index->getFinalGraph()[query][j].distance;
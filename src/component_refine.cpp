@@ -6,6 +6,112 @@
 
 namespace weavess {
 
+    /**
+     * 并行插入反向边：目标结点按 pass_nodes 分段依次处理，每段内各线程把 FinalGraph 中指向该段的边 n -> des
+     * 按 des 所在的结点块分桶，作为 des 的反向候选，再按桶并行，对每个结点一次合并已有邻居与全部反向候选，
+     * 超过 range 时调用 InterInsert 裁剪。同时暂存的反向边只有一段的量，不随总边数增长；
+     * 收集阶段只读、合并阶段每个结点只由一个线程写，无需加锁。每行按合并后的实际邻居数分配
+     * @param range 每个结点的邻居上限
+     */
+    void ComponentRefine::ReverseLink(unsigned range) {
+        struct ReverseEdge {
+            unsigned des;
+            Index::SimpleNeighbor nn;
+
+            bool operator<(const ReverseEdge &other) const {
+                if (des != other.des) return des < other.des;
+                if (nn.distance != other.nn.distance) return nn.distance < other.nn.distance;
+                return nn.id < other.nn.id;
+            }
+        };
+
+        auto &graph = index->getFinalGraph();
+        const unsigned N = index->getBaseLen();
+        const unsigned block = 1024;
+        // 每段至多约 N / 32 个结点（不少于 2^16 个），暂存的反向边约为全部边的 1/32，扫描全图的次数有上限
+        unsigned pass_nodes = std::max(1u << 16, (N + 31) / 32);
+        pass_nodes = (pass_nodes + block - 1) / block * block;
+        std::vector<std::vector<std::vector<ReverseEdge>>> buckets(omp_get_max_threads());
+
+        for (unsigned lo = 0; lo < N; lo += pass_nodes) {
+            const unsigned hi = std::min(N, lo + pass_nodes);
+            const unsigned bucket_num = (hi - lo + block - 1) / block;
+
+#pragma omp parallel
+            {
+                auto &local = buckets[omp_get_thread_num()];
+                local.resize(bucket_num);
+#pragma omp for schedule(dynamic, 100)
+                for (unsigned n = 0; n < N; ++n) {
+                    for (const auto &nn : graph[n]) {
+                        unsigned des = nn.id;
+                        if (des == n || des < lo || des >= hi) continue;
+
+                        // 已有 des -> n 的边
+                        bool dup = false;
+                        for (const auto &back : graph[des]) {
+                            if (back.id == n) {
+                                dup = true;
+                                break;
+                            }
+                        }
+                        if (dup) continue;
+
+                        local[(des - lo) / block].push_back({des, Index::SimpleNeighbor(n, nn.distance)});
+                    }
+                }
+            }
+
+#pragma omp parallel
+            {
+                std::vector<ReverseEdge> edges;
+                std::vector<Index::SimpleNeighbor> pool, result;
+#pragma omp for schedule(dynamic)
+                for (unsigned b = 0; b < bucket_num; b++) {
+                    edges.clear();
+                    for (auto &local : buckets) {
+                        if (local.empty()) continue;
+                        edges.insert(edges.end(), local[b].begin(), local[b].end());
+                        std::vector<ReverseEdge>().swap(local[b]);
+                    }
+                    // 排序后结果与线程调度无关
+                    std::sort(edges.begin(), edges.end());
+
+                    for (size_t s = 0, e; s < edges.size(); s = e) {
+                        unsigned des = edges[s].des;
+
+                        pool.assign(graph[des].begin(), graph[des].end());
+                        for (e = s; e < edges.size() && edges[e].des == des; e++) {
+                            pool.push_back(edges[e].nn);
+                        }
+
+                        if (pool.size() > range) {
+                            std::sort(pool.begin(), pool.end());
+                            result.clear();
+                            InterInsert(des, range, pool, result);
+                            pool.swap(result);
+                        }
+
+                        std::vector<Index::SimpleNeighbor>(pool.begin(), pool.end()).swap(graph[des]);
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * 将 PruneInner 写入的一行转存为按实际邻居数分配的邻居表
+     * @param range des_pool 的槽位数
+     * @param des_pool 裁边结果，不足 range 时以 distance == -1 结尾
+     * @param row 输出行
+     */
+    void ComponentRefine::CopyPruned(unsigned range, const Index::SimpleNeighbor *des_pool,
+                                     std::vector<Index::SimpleNeighbor> &row) {
+        unsigned len = 0;
+        while (len < range && des_pool[len].distance != -1) len++;
+        std::vector<Index::SimpleNeighbor>(des_pool, des_pool + len).swap(row);
+    }
+
     /**
      * NN-Descent Refine
      */
@@ -19,68 +125,40 @@ namespace weavess {
 
         NNDescent();
 
-        // graph_ -> final_graph
+        // flat_graph_ -> final_graph
 #pragma omp parallel for
         for (unsigned i = 0; i < index->getBaseLen(); i++) {
-            std::vector<Index::SimpleNeighbor> tmp;
-            tmp.reserve(index->getCandidatesEdgesNum());
+            Index::Neighbor *pool = index->flat_graph_.pool(i);
+            unsigned pool_size = index->flat_graph_.pool_size[i];
+            std::sort(pool, pool + pool_size);
 
-            std::sort(index->graph_[i].pool.begin(), index->graph_[i].pool.end());
-
-            for (auto &j : index->graph_[i].pool) {
-                tmp.push_back(Index::SimpleNeighbor(j.id, j.distance));
+            std::vector<Index::SimpleNeighbor> tmp;
+            tmp.reserve(pool_size);
+            for (unsigned j = 0; j < pool_size; j++) {
+                tmp.push_back(Index::SimpleNeighbor(pool[j].id, pool[j].distance));
             }
 
             index->getFinalGraph()[i].swap(tmp);
-
-            // 内存释放
-            std::vector<Index::Neighbor>().swap(index->graph_[i].pool);
-            std::vector<unsigned>().swap(index->graph_[i].nn_new);
-            std::vector<unsigned>().swap(index->graph_[i].nn_old);
-            std::vector<unsigned>().swap(index->graph_[i].rnn_new);
-            std::vector<unsigned>().swap(index->graph_[i].rnn_new);
         }
 
         // 内存释放
-        std::vector<Index::nhood>().swap(index->graph_);
+        index->flat_graph_.clear();
 
         // 裁边
         unsigned range = index->getResultEdgesNum();
 
-        auto *cut_graph_ = new Index::SimpleNeighbor[index->getBaseLen() * range];
-
         // PRUNE
         std::cout << "__PRUNE : NAIVE__" << std::endl;
         auto *b = new ComponentPruneNaive(index);
 
+        // 裁边只依赖结点自身的邻居，直接写回该行并按实际邻居数重新分配，不需要 N * range 的裁边缓冲
 #ifdef PARALLEL
-#pragma omp parallel
-#endif
-        {
-            boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
-#ifdef PARALLEL
-#pragma omp for schedule(dynamic, 100)
-#endif
-            for (unsigned n = 0; n < index->getBaseLen(); ++n) {
-                b->PruneInner(n, range, flags, index->getFinalGraph()[n], cut_graph_);
-            }
-        }
-
-#ifdef PARALLEL
-#pragma omp for schedule(dynamic, 100)
+#pragma omp parallel for schedule(dynamic, 100)
 #endif
         for (unsigned n = 0; n < index->getBaseLen(); ++n) {
-            Index::SimpleNeighbor *src_pool = cut_graph_ + n * range;
-            int len = 0;
-            for (unsigned i = 0; i < range; i++) {
-                if (src_pool[i].distance == -1) break;
-                len++;
-                index->getFinalGraph()[n][i] = src_pool[i];
-            }
-            index->getFinalGraph()[n].resize(len);
+            b->PruneToRange(range, index->getFinalGraph()[n]);
+            index->getFinalGraph()[n].shrink_to_fit();
         }
-
-        delete[] cut_graph_;
     }
 
     void ComponentRefineNNDescent::SetConfigs() {
@@ -89,196 +167,284 @@ namespace weavess {
 
         index->R = index->getParam().get<unsigned>("R");
         index->ITER = index->getParam().get<unsigned>("ITER");
+        index->delta = index->getParam().get<float>("delta", 0.001);
+        index->recall_sample = index->getParam().get<unsigned>("recall_sample", CONTROL_NUM);
     }
 
     void ComponentRefineNNDescent::init() {
-        index->graph_.reserve(index->getBaseLen());
-        for (unsigned i = 0; i < index->getBaseLen(); i++) {
-            index->graph_.emplace_back(Index::nhood(index->getCandidatesEdgesNum(), index->getInitEdgesNum()));
-        }
+        index->nhood_locks_.resize(StripedLocks::StripesForThreads(index->n_threads_));
+        Index::FlatGraph &graph = index->flat_graph_;
+        graph.init(index->getBaseLen(), index->getCandidatesEdgesNum(), index->getInitEdgesNum(), index->R);
 
 #ifdef PARALLEL
 #pragma omp parallel for
 #endif
         for (unsigned i = 0; i < index->getBaseLen(); i++) {
-            for (unsigned j = 0; j < index->getFinalGraph()[i].size(); j++) {
+            Index::Neighbor *pool = graph.pool(i);
+            unsigned pool_size = std::min((unsigned) index->getFinalGraph()[i].size(), graph.pool_cap);
+            for (unsigned j = 0; j < pool_size; j++) {
                 Index::SimpleNeighbor node = index->getFinalGraph()[i][j];
-                index->graph_[i].pool.emplace_back(Index::Neighbor(node.id, node.distance, true));
+                pool[j] = Index::Neighbor(node.id, node.distance, true);
             }
-            std::make_heap(index->graph_[i].pool.begin(), index->graph_[i].pool.end());
-            index->graph_[i].pool.reserve(index->getCandidatesEdgesNum());
+            std::make_heap(pool, pool + pool_size);
+            graph.pool_size[i] = pool_size;
         }
     }
 
+    /**
+     * 迭代至多 ITER 轮，单轮候选池更新数低于 delta * N * L 时认为已收敛；
+     * recall_sample 不为 0 时每轮用采样点的精确近邻估计 recall@K
+     */
     void ComponentRefineNNDescent::NNDescent() {
-        if (index->debug == true) {
+        const unsigned N = index->getBaseLen();
+        const double threshold = (double) index->delta * N * index->getCandidatesEdgesNum();
+
+        std::vector<unsigned> control_points(std::min(index->recall_sample, N));
+        std::vector<std::vector<unsigned> > acc_eval_set(control_points.size());
+        if (!control_points.empty()) {
             std::mt19937 rng(rand());
-            std::vector<unsigned> control_points(CONTROL_NUM);
-            std::vector<std::vector<unsigned> > acc_eval_set(CONTROL_NUM);
-            GenRandom(rng, &control_points[0], control_points.size(), index->getBaseLen());
-            generate_control_set(control_points, acc_eval_set, index->getBaseLen());
-            for (unsigned it = 0; it < index->ITER; it++) {
-                join();
-                update();
-                std::cout << "NN-Descent iter: " << it << std::endl;
-                eval_recall(control_points, acc_eval_set);
+            GenRandom(rng, &control_points[0], control_points.size(), N);
+            generate_control_set(control_points, acc_eval_set, N);
+        }
+
+        for (unsigned it = 0; it < index->ITER; it++) {
+            // 先由初始候选池采样新旧邻居，再做局部连接
+            update();
+            size_t updates = join();
+
+            std::cout << "NN-Descent iter: " << it << " updates: " << updates;
+            if (!control_points.empty()) {
+                std::cout << " recall@" << index->getResultEdgesNum() << ": " << eval_recall(control_points, acc_eval_set);
             }
-        } else {
-            for (unsigned it = 0; it < index->ITER; it++) {
-                join();
-                update();
+            std::cout << std::endl;
+
+            if (updates <= threshold) {
+                std::cout << "NN-Descent converged after " << it + 1 << " iterations" << std::endl;
+                break;
             }
         }
     }
 
-    void ComponentRefineNNDescent::join() {
+    /**
+     * 分块局部连接：把结点的新旧邻居向量收集到连续的 tile 中，逐行用 compare_block 计算该行与其后各行的距离
+     * （新-新、新-旧），再按目标结点汇总更新，每个目标结点只加一次锁；返回本轮候选池的更新次数
+     */
+    size_t ComponentRefineNNDescent::join() {
+        Index::FlatGraph &graph = index->flat_graph_;
+        const unsigned dim = index->getBaseDim();
+        size_t updated = 0;
 #ifdef PARALLEL
-#pragma omp parallel for default(shared) schedule(dynamic, 100)
+#pragma omp parallel reduction(+:updated)
 #endif
-        for (unsigned n = 0; n < index->getBaseLen(); n++) {
-            index->graph_[n].join([&](unsigned i, unsigned j) {
-                if (i != j) {
-                    float dist = index->getDist()->compare(index->getBaseData() + i * index->getBaseDim(),
-                                                           index->getBaseData() + j * index->getBaseDim(),
-                                                           index->getBaseDim());
+        {
+            std::vector<unsigned> ids;
+            std::vector<float> tile;
+            std::vector<float> dists;
+            std::vector<std::vector<std::pair<unsigned, float>>> updates;
+#ifdef PARALLEL
+#pragma omp for schedule(dynamic, 100)
+#endif
+            for (unsigned n = 0; n < index->getBaseLen(); n++) {
+                const unsigned new_num = graph.nn_new_size[n];
+                if (new_num == 0) continue;
+
+                ids.assign(graph.new_list(n), graph.new_list(n) + new_num);
+                ids.insert(ids.end(), graph.old_list(n), graph.old_list(n) + graph.nn_old_size[n]);
+                const unsigned num = ids.size();
+
+                tile.resize((size_t) num * dim);
+                for (unsigned r = 0; r < num; r++) {
+                    std::memcpy(tile.data() + (size_t) r * dim, index->getBaseData() + (size_t) ids[r] * dim,
+                                dim * sizeof(float));
+                }
+                if (updates.size() < num) updates.resize(num);
+                for (unsigned r = 0; r < num; r++) updates[r].clear();
+
+                // 新邻居行与其后的新邻居、旧邻居行两两计算
+                dists.resize(num);
+                for (unsigned r = 0; r < new_num; r++) {
+                    const unsigned rest = num - r - 1;
+                    if (rest == 0) break;
+                    index->getDist()->compare_block(tile.data() + (size_t) r * dim, tile.data() + (size_t) (r + 1) * dim,
+                                                    rest, dim, dists.data());
+                    for (unsigned c = 0; c < rest; c++) {
+                        unsigned other = r + 1 + c;
+                        if (ids[r] == ids[other]) continue;
+                        updates[r].emplace_back(ids[other], dists[c]);
+                        updates[other].emplace_back(ids[r], dists[c]);
+                    }
+                }
 
-                    index->graph_[i].insert(j, dist);
-                    index->graph_[j].insert(i, dist);
+                for (unsigned r = 0; r < num; r++) {
+                    if (updates[r].empty()) continue;
+                    Index::LockGuard guard(index->nhood_locks_[ids[r]]);
+                    for (const auto &u : updates[r]) {
+                        updated += graph.insert(ids[r], u.first, u.second);
+                    }
                 }
-            });
+            }
         }
+        return updated;
     }
 
+    /**
+     * 由候选池采样下一轮的新旧邻居与反向邻居，只改写 flat_graph_ 中各段的长度，不分配内存；
+     * 反向邻居满后随机替换，随机数取各线程独立的 mt19937
+     */
     void ComponentRefineNNDescent::update() {
-#ifdef PARALLEL
-#pragma omp parallel for
-#endif
-        for (unsigned i = 0; i < index->getBaseLen(); i++) {
-            std::vector<unsigned>().swap(index->graph_[i].nn_new);
-            std::vector<unsigned>().swap(index->graph_[i].nn_old);
-            //std::vector<unsigned>().swap(graph_[i].rnn_new);
-            //std::vector<unsigned>().swap(graph_[i].rnn_old);
-            //graph_[i].nn_new.clear();
-            //graph_[i].nn_old.clear();
-            //graph_[i].rnn_new.clear();
-            //graph_[i].rnn_old.clear();
-        }
+        Index::FlatGraph &graph = index->flat_graph_;
+        const unsigned S = index->getInitEdgesNum();
+        const unsigned seed = rand();
+
+        // 候选池排序，确定本轮采样范围 M
 #ifdef PARALLEL
 #pragma omp parallel for
 #endif
         for (unsigned n = 0; n < index->getBaseLen(); ++n) {
-            auto &nn = index->graph_[n];
-            std::sort(nn.pool.begin(), nn.pool.end());
-            if (nn.pool.size() > index->getCandidatesEdgesNum())nn.pool.resize(index->getCandidatesEdgesNum());
-            nn.pool.reserve(index->getCandidatesEdgesNum());
-            unsigned maxl = std::min(nn.M + index->getInitEdgesNum(), (unsigned) nn.pool.size());
+            Index::Neighbor *pool = graph.pool(n);
+            unsigned pool_size = graph.pool_size[n];
+            std::sort(pool, pool + pool_size);
+            unsigned maxl = std::min(graph.M[n] + S, pool_size);
             unsigned c = 0;
             unsigned l = 0;
-            //std::sort(nn.pool.begin(), nn.pool.end());
-            //if(n==0)std::cout << nn.pool[0].distance<<","<< nn.pool[1].distance<<","<< nn.pool[2].distance<< std::endl;
-            while ((l < maxl) && (c < index->getInitEdgesNum())) {
-                if (nn.pool[l].flag) ++c;
+            while ((l < maxl) && (c < S)) {
+                if (pool[l].flag) ++c;
                 ++l;
             }
-            nn.M = l;
+            graph.M[n] = l;
+            graph.nn_new_size[n] = 0;
+            graph.nn_old_size[n] = 0;
         }
+
 #ifdef PARALLEL
-#pragma omp parallel for
+#pragma omp parallel
 #endif
-        for (unsigned n = 0; n < index->getBaseLen(); ++n) {
-            auto &nnhd = index->graph_[n];
-            auto &nn_new = nnhd.nn_new;
-            auto &nn_old = nnhd.nn_old;
-            for (unsigned l = 0; l < nnhd.M; ++l) {
-                auto &nn = nnhd.pool[l];
-                auto &nhood_o = index->graph_[nn.id];  // nn on the other side of the edge
-
-                if (nn.flag) {
-                    nn_new.push_back(nn.id);
-                    if (nn.distance > nhood_o.pool.back().distance) {
-                        Index::LockGuard guard(nhood_o.lock);
-                        if (nhood_o.rnn_new.size() < index->R)nhood_o.rnn_new.push_back(n);
-                        else {
-                            unsigned int pos = rand() % index->R;
-                            nhood_o.rnn_new[pos] = n;
+        {
+            std::mt19937 rng(seed ^ omp_get_thread_num());
+#ifdef PARALLEL
+#pragma omp for
+#endif
+            for (unsigned n = 0; n < index->getBaseLen(); ++n) {
+                Index::Neighbor *pool = graph.pool(n);
+                unsigned *nn_new = graph.new_list(n);
+                unsigned *nn_old = graph.old_list(n);
+                for (unsigned l = 0; l < graph.M[n]; ++l) {
+                    auto &nn = pool[l];
+                    // nn on the other side of the edge，候选池为空时总是加入其反向邻居
+                    float other_bound = graph.pool_size[nn.id] > 0
+                                        ? graph.pool(nn.id)[graph.pool_size[nn.id] - 1].distance : -1;
+
+                    if (nn.flag) {
+                        nn_new[graph.nn_new_size[n]++] = nn.id;
+                        if (nn.distance > other_bound) {
+                            Index::LockGuard guard(index->nhood_locks_[nn.id]);
+                            Index::FlatGraph::push_reverse(graph.reverse_new(nn.id), graph.rnn_new_size[nn.id],
+                                                           graph.rnn_cap, n, rng);
                         }
-                    }
-                    nn.flag = false;
-                } else {
-                    nn_old.push_back(nn.id);
-                    if (nn.distance > nhood_o.pool.back().distance) {
-                        Index::LockGuard guard(nhood_o.lock);
-                        if (nhood_o.rnn_old.size() < index->R)nhood_o.rnn_old.push_back(n);
-                        else {
-                            unsigned int pos = rand() % index->R;
-                            nhood_o.rnn_old[pos] = n;
+                        nn.flag = false;
+                    } else {
+                        nn_old[graph.nn_old_size[n]++] = nn.id;
+                        if (nn.distance > other_bound) {
+                            Index::LockGuard guard(index->nhood_locks_[nn.id]);
+                            Index::FlatGraph::push_reverse(graph.reverse_old(nn.id), graph.rnn_old_size[nn.id],
+                                                           graph.rnn_cap, n, rng);
                         }
                     }
                 }
             }
-            std::make_heap(nnhd.pool.begin(), nnhd.pool.end());
         }
+
+        // 合并反向邻居，候选池恢复为大顶堆
 #ifdef PARALLEL
 #pragma omp parallel for
 #endif
-        for (unsigned i = 0; i < index->getBaseLen(); ++i) {
-            auto &nn_new = index->graph_[i].nn_new;
-            auto &nn_old = index->graph_[i].nn_old;
-            auto &rnn_new = index->graph_[i].rnn_new;
-            auto &rnn_old = index->graph_[i].rnn_old;
-            if (index->R && rnn_new.size() > index->R) {
-                std::random_shuffle(rnn_new.begin(), rnn_new.end());
-                rnn_new.resize(index->R);
+        for (unsigned n = 0; n < index->getBaseLen(); ++n) {
+            Index::Neighbor *pool = graph.pool(n);
+            std::make_heap(pool, pool + graph.pool_size[n]);
+
+            unsigned *nn_new = graph.new_list(n);
+            unsigned *rnn_new = graph.reverse_new(n);
+            for (unsigned i = 0; i < graph.rnn_new_size[n]; i++) {
+                nn_new[graph.nn_new_size[n]++] = rnn_new[i];
             }
-            nn_new.insert(nn_new.end(), rnn_new.begin(), rnn_new.end());
-            if (index->R && rnn_old.size() > index->R) {
-                std::random_shuffle(rnn_old.begin(), rnn_old.end());
-                rnn_old.resize(index->R);
+            unsigned *nn_old = graph.old_list(n);
+            unsigned *rnn_old = graph.reverse_old(n);
+            for (unsigned i = 0; i < graph.rnn_old_size[n]; i++) {
+                nn_old[graph.nn_old_size[n]++] = rnn_old[i];
             }
-            nn_old.insert(nn_old.end(), rnn_old.begin(), rnn_old.end());
-            if (nn_old.size() > index->R * 2) {
-                nn_old.resize(index->R * 2);
-                nn_old.reserve(index->R * 2);
+            if (graph.nn_old_size[n] > index->R * 2) {
+                graph.nn_old_size[n] = index->R * 2;
             }
-            std::vector<unsigned>().swap(index->graph_[i].rnn_new);
-            std::vector<unsigned>().swap(index->graph_[i].rnn_old);
+            graph.rnn_new_size[n] = 0;
+            graph.rnn_old_size[n] = 0;
         }
     }
 
+    /**
+     * 采样点的精确 K 近邻（不含自身），距离按 compare_block 对连续的基础数据成块计算
+     */
     void ComponentRefineNNDescent::generate_control_set(std::vector<unsigned> &c,
-                                        std::vector<std::vector<unsigned> > &v,
-                                        unsigned N){
-#pragma omp parallel for
-    for(unsigned i=0; i<c.size(); i++){
-        std::vector<NNDescent::Neighbor> tmp;
-        for(unsigned j=0; j<N; j++){
-        float dist = index->getDist()->compare(index->getBaseData() + c[i] * index->getBaseDim(), index->getBaseData() + j * index->getBaseDim(), index->getBaseDim());
-        tmp.push_back(NNDescent::Neighbor(j, dist, true));
-        }
-        std::partial_sort(tmp.begin(), tmp.begin() + CONTROL_NUM, tmp.end());
-        for(unsigned j=0; j<CONTROL_NUM; j++){
-        v[i].push_back(tmp[j].id);
+                                                        std::vector<std::vector<unsigned> > &v,
+                                                        unsigned N) {
+        const unsigned K = std::min(index->getResultEdgesNum(), N - 1);
+        const unsigned dim = index->getBaseDim();
+        const unsigned block = 4096;
+#ifdef PARALLEL
+#pragma omp parallel
+#endif
+        {
+            std::vector<float> dists(block);
+            std::vector<Index::SimpleNeighbor> heap;
+#ifdef PARALLEL
+#pragma omp for schedule(dynamic, 1)
+#endif
+            for (unsigned i = 0; i < c.size(); i++) {
+                const float *query = index->getBaseData() + (size_t) c[i] * dim;
+                heap.clear();
+                for (unsigned start = 0; start < N; start += block) {
+                    unsigned num = std::min(block, N - start);
+                    index->getDist()->compare_block(query, index->getBaseData() + (size_t) start * dim, num, dim,
+                                                    dists.data());
+                    for (unsigned j = 0; j < num; j++) {
+                        if (start + j == c[i]) continue;
+                        if (heap.size() < K) {
+                            heap.emplace_back(start + j, dists[j]);
+                            std::push_heap(heap.begin(), heap.end());
+                        } else if (dists[j] < heap.front().distance) {
+                            std::pop_heap(heap.begin(), heap.end());
+                            heap.back() = Index::SimpleNeighbor(start + j, dists[j]);
+                            std::push_heap(heap.begin(), heap.end());
+                        }
+                    }
+                }
+                v[i].clear();
+                for (const auto &nn : heap) v[i].push_back(nn.id);
+            }
         }
     }
-    }
 
-    void ComponentRefineNNDescent::eval_recall(std::vector<unsigned>& ctrl_points, std::vector<std::vector<unsigned> > &acc_eval_set){
-    float mean_acc=0;
-    for(unsigned i=0; i<ctrl_points.size(); i++){
-        float acc = 0;
-        auto &g = index->graph_[ctrl_points[i]].pool;
-        auto &v = acc_eval_set[i];
-        for(unsigned j=0; j<g.size(); j++){
-        for(unsigned k=0; k<v.size(); k++){
-            if(g[j].id == v[k]){
-            acc++;
-            break;
+    /**
+     * 采样点候选池中最近的 K 个与精确 K 近邻的重合比例
+     */
+    float ComponentRefineNNDescent::eval_recall(std::vector<unsigned> &ctrl_points,
+                                                std::vector<std::vector<unsigned> > &acc_eval_set) {
+        float mean_acc = 0;
+        std::vector<Index::Neighbor> pool;
+        for (unsigned i = 0; i < ctrl_points.size(); i++) {
+            auto &v = acc_eval_set[i];
+            if (v.empty()) continue;
+            const Index::Neighbor *g = index->flat_graph_.pool(ctrl_points[i]);
+            pool.assign(g, g + index->flat_graph_.pool_size[ctrl_points[i]]);
+            unsigned K = std::min((unsigned) v.size(), (unsigned) pool.size());
+            std::partial_sort(pool.begin(), pool.begin() + K, pool.end());
+
+            float acc = 0;
+            for (unsigned j = 0; j < K; j++) {
+                if (std::find(v.begin(), v.end(), pool[j].id) != v.end()) acc++;
             }
+            mean_acc += acc / v.size();
         }
-        }
-        mean_acc += acc / v.size();
-    }
-    std::cout<<"Graph Quality : "<<mean_acc / ctrl_points.size() <<std::endl;
+        return mean_acc / ctrl_points.size();
     }
 
     /**
@@ -291,41 +457,18 @@ namespace weavess {
 
         unsigned range = index->R_refine;
 
-        auto *cut_graph_ = new Index::SimpleNeighbor[index->getBaseLen() * range];
-
         // PRUNE
         std::cout << "__PRUNE : RNG__" << std::endl;
         auto *b = new ComponentPruneHeuristic(index);
 
+        // 裁边只依赖结点自身的邻居，直接写回该行并按实际邻居数重新分配，不需要 N * range 的裁边缓冲
 #ifdef PARALLEL
-#pragma omp parallel
-#endif
-        {
-            boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
-#ifdef PARALLEL
-#pragma omp for schedule(dynamic, 100)
-#endif
-            for (unsigned n = 0; n < index->getBaseLen(); ++n) {
-
-                b->PruneInner(n, range, flags, index->getFinalGraph()[n], cut_graph_);
-            }
-        }
-
-#ifdef PARALLEL
-#pragma omp for schedule(dynamic, 100)
+#pragma omp parallel for schedule(dynamic, 100)
 #endif
         for (unsigned n = 0; n < index->getBaseLen(); ++n) {
-            Index::SimpleNeighbor *src_pool = cut_graph_ + n * range;
-            int len = 0;
-            for (unsigned i = 0; i < range; i++) {
-                if (src_pool[i].distance == -1) break;
-                len++;
-                index->getFinalGraph()[n][i] = src_pool[i];
-            }
-            index->getFinalGraph()[n].resize(len);
+            b->PruneToRange(range, index->getFinalGraph()[n]);
+            index->getFinalGraph()[n].shrink_to_fit();
         }
-
-        delete[] cut_graph_;
     }
 
     void ComponentRefineFANNG::SetConfigs() {
@@ -351,25 +494,7 @@ namespace weavess {
         a->EntryInner();
         std::cout << "__ENTRY : FINISH" << std::endl;
 
-        auto *cut_graph_ = new Index::SimpleNeighbor[index->getBaseLen() * (size_t) index->R_refine];
-        Link(cut_graph_);
-
-        index->getFinalGraph().resize(index->getBaseLen());
-
-        for (size_t i = 0; i < index->getBaseLen(); i++) {
-            Index::SimpleNeighbor *pool = cut_graph_ + i * (size_t) index->R_refine;
-            unsigned pool_size = 0;
-            for (unsigned j = 0; j < index->R_refine; j++) {
-                if (pool[j].distance == -1) break;
-                pool_size = j;
-            }
-            pool_size++;
-            index->getFinalGraph()[i].resize(pool_size);
-            for (unsigned j = 0; j < pool_size; j++) {
-                index->getFinalGraph()[i][j].id = pool[j].id;
-                index->getFinalGraph()[i][j].distance = pool[j].distance;
-            }
-        }
+        Link();
 
         // CONN
         std::cout << "__CONN : DFS__" << std::endl;
@@ -386,8 +511,11 @@ namespace weavess {
         index->width = index->R_refine;
     }
 
-    void ComponentRefineNSG::Link(Index::SimpleNeighbor *cut_graph_) {
-        std::vector<std::mutex> locks(index->getBaseLen());
+    /**
+     * 候选搜索读取原图，裁边结果按实际邻居数写入新图，全部结点完成后替换 FinalGraph 并释放原图，
+     * 再在新图上插入反向边
+     */
+    void ComponentRefineNSG::Link() {
 
         // CANDIDATE
         std::cout << "__CANDIDATE : GREEDY(NSG)__" << std::endl;
@@ -397,97 +525,55 @@ namespace weavess {
         std::cout << "__PRUNE : NSG__" << std::endl;
         auto *b = new ComponentPruneNSG(index);
 
+        std::vector<std::vector<Index::SimpleNeighbor>> cut_graph(index->getBaseLen());
 #pragma omp parallel
         {
             std::vector<Index::SimpleNeighbor> pool;
-            boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
+            std::vector<Index::SimpleNeighbor> des_pool(index->R_refine);
+            Index::BuildScratch scratch(index->getBaseLen());
 
 #pragma omp for schedule(dynamic, 100)
             for (unsigned n = 0; n < index->getBaseLen(); ++n) {
                 pool.clear();
-                flags.reset();
+                scratch.reset();
 
-                a->CandidateInner(n, index->ep_, flags, pool);
+                a->CandidateInner(n, index->ep_, scratch, pool);
                 //std::cout << n << " candidate : " << pool.size() << std::endl;
-                b->PruneInner(n, index->R_refine, flags, pool, cut_graph_);
+                b->PruneInner(n, index->R_refine, scratch, pool, des_pool.data());
+                CopyPruned(index->R_refine, des_pool.data(), cut_graph[n]);
                 //std::cout << n << " prune : " << pool.size() << std::endl;
             }
 
             std::vector<Index::SimpleNeighbor>().swap(pool);
         }
+        index->getFinalGraph().swap(cut_graph);
+        std::vector<std::vector<Index::SimpleNeighbor>>().swap(cut_graph);
 
-#pragma omp for schedule(dynamic, 100)
-        for (unsigned n = 0; n < index->getBaseLen(); ++n) {
-            InterInsert(n, index->R_refine, locks, cut_graph_);
-        }
+        ReverseLink(index->R_refine);
     }
 
-    void ComponentRefineNSG::InterInsert(unsigned n, unsigned range, std::vector<std::mutex> &locks,
-                                         Index::SimpleNeighbor *cut_graph_) {
-        Index::SimpleNeighbor *src_pool = cut_graph_ + (size_t) n * (size_t) range;
-        for (size_t i = 0; i < range; i++) {
-            if (src_pool[i].distance == -1) break;
-
-            Index::SimpleNeighbor sn(n, src_pool[i].distance);
-            size_t des = src_pool[i].id;
-            Index::SimpleNeighbor *des_pool = cut_graph_ + des * (size_t) range;
-
-            std::vector<Index::SimpleNeighbor> temp_pool;
-            int dup = 0;
-            {
-                Index::LockGuard guard(locks[des]);
-                for (size_t j = 0; j < range; j++) {
-                    if (des_pool[j].distance == -1) break;
-                    if (n == des_pool[j].id) {
-                        dup = 1;
-                        break;
-                    }
-                    temp_pool.push_back(des_pool[j]);
+    void ComponentRefineNSG::InterInsert(unsigned n, unsigned range, std::vector<Index::SimpleNeighbor> &pool,
+                                         std::vector<Index::SimpleNeighbor> &result) {
+        unsigned start = 0;
+        result.push_back(pool[start]);
+        while (result.size() < range && (++start) < pool.size()) {
+            auto &p = pool[start];
+            bool occlude = false;
+            for (unsigned t = 0; t < result.size(); t++) {
+                if (p.id == result[t].id) {
+                    occlude = true;
+                    break;
                 }
-            }
-            if (dup) continue;
-
-            temp_pool.push_back(sn);
-            if (temp_pool.size() > range) {
-                std::vector<Index::SimpleNeighbor> result;
-                unsigned start = 0;
-                std::sort(temp_pool.begin(), temp_pool.end());
-                result.push_back(temp_pool[start]);
-                while (result.size() < range && (++start) < temp_pool.size()) {
-                    auto &p = temp_pool[start];
-                    bool occlude = false;
-                    for (unsigned t = 0; t < result.size(); t++) {
-                        if (p.id == result[t].id) {
-                            occlude = true;
-                            break;
-                        }
-                        float djk = index->getDist()->compare(
-                                index->getBaseData() + index->getBaseDim() * (size_t) result[t].id,
-                                index->getBaseData() + index->getBaseDim() * (size_t) p.id,
-                                (unsigned) index->getBaseDim());
-                        if (djk < p.distance /* dik */) {
-                            occlude = true;
-                            break;
-                        }
-                    }
-                    if (!occlude) result.push_back(p);
-                }
-                {
-                    Index::LockGuard guard(locks[des]);
-                    for (unsigned t = 0; t < result.size(); t++) {
-                        des_pool[t] = result[t];
-                    }
-                }
-            } else {
-                Index::LockGuard guard(locks[des]);
-                for (unsigned t = 0; t < range; t++) {
-                    if (des_pool[t].distance == -1) {
-                        des_pool[t] = sn;
-                        if (t + 1 < range) des_pool[t + 1].distance = -1;
-                        break;
-                    }
+                float djk = index->getDist()->compare(
+                        index->getBaseData() + index->getBaseDim() * (size_t) result[t].id,
+                        index->getBaseData() + index->getBaseDim() * (size_t) p.id,
+                        (unsigned) index->getBaseDim());
+                if (djk < p.distance /* dik */) {
+                    occlude = true;
+                    break;
                 }
             }
+            if (!occlude) result.push_back(p);
         }
     }
 
@@ -505,25 +591,7 @@ namespace weavess {
         // auto *a = new ComponentRefineEntryCentroid(index);
         // a->EntryInner();
 
-        auto *cut_graph_ = new Index::SimpleNeighbor[index->getBaseLen() * (size_t) index->R_refine];
-        Link(cut_graph_);
-
-        index->getFinalGraph().resize(index->getBaseLen());
-
-        for (size_t i = 0; i < index->getBaseLen(); i++) {
-            Index::SimpleNeighbor *pool = cut_graph_ + i * (size_t) index->R_refine;
-            unsigned pool_size = 0;
-            for (unsigned j = 0; j < index->R_refine; j++) {
-                if (pool[j].distance == -1) break;
-                pool_size = j;
-            }
-            pool_size++;
-            index->getFinalGraph()[i].resize(pool_size);
-            for (unsigned j = 0; j < pool_size; j++) {
-                Index::SimpleNeighbor nn(pool[j].id, pool[j].distance);
-                index->getFinalGraph()[i][j] = nn;
-            }
-        }
+        Link();
 
         // CONN
         std::cout << "__CONN : DFS__" << std::endl;
@@ -541,7 +609,8 @@ namespace weavess {
         index->width = index->R_refine;
     }
 
-    void ComponentRefineSSG::Link(Index::SimpleNeighbor *cut_graph_) {
+    // 与 NSG 相同，裁边结果写入按实际邻居数分配的新图，完成后替换 FinalGraph
+    void ComponentRefineSSG::Link() {
         /*
          std::cerr << "Graph Link" << std::endl;
          unsigned progress = 0;
@@ -549,7 +618,6 @@ namespace weavess {
          unsigned step_size = nd_ / percent;
          std::mutex progress_lock;
          */
-        std::vector<std::mutex> locks(index->getBaseLen());
 
         // CANDIDATE
         std::cout << "__CANDIDATE : PROPAGATION 2__" << std::endl;
@@ -559,21 +627,24 @@ namespace weavess {
         std::cout << "__PRUNE : NSSG__" << std::endl;
         ComponentPrune *b = new ComponentPruneSSG(index);
 
+        std::vector<std::vector<Index::SimpleNeighbor>> cut_graph(index->getBaseLen());
 #pragma omp parallel
         {
             // unsigned cnt = 0;
             std::vector<Index::SimpleNeighbor> pool;
-            boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
+            std::vector<Index::SimpleNeighbor> des_pool(index->R_refine);
+            Index::BuildScratch scratch(index->getBaseLen());
 
 #pragma omp for schedule(dynamic, 100)
             for (unsigned n = 0; n < index->getBaseLen(); ++n) {
                 pool.clear();
-                flags.reset();
+                scratch.reset();
 
-                a->CandidateInner(n, n, flags, pool);
+                a->CandidateInner(n, n, scratch, pool);
                 //std::cout << "candidate : " << pool.size() << std::endl;
 
-                b->PruneInner(n, index->R_refine, flags, pool, cut_graph_);
+                b->PruneInner(n, index->R_refine, scratch, pool, des_pool.data());
+                CopyPruned(index->R_refine, des_pool.data(), cut_graph[n]);
                 //std::cout << "prune : " << pool.size() << std::endl;
 
                 /*
@@ -585,87 +656,39 @@ namespace weavess {
                 */
             }
         }
+        index->getFinalGraph().swap(cut_graph);
+        std::vector<std::vector<Index::SimpleNeighbor>>().swap(cut_graph);
 
-        double kPi = std::acos(-1);
-        float threshold = std::cos(index->A / 180 * kPi);
-
-#pragma omp for schedule(dynamic, 100)
-        for (unsigned n = 0; n < index->getBaseLen(); ++n) {
-            InterInsert(n, index->R_refine, threshold, locks, cut_graph_);
-        }
+        ReverseLink(index->R_refine);
     }
 
-    void ComponentRefineSSG::InterInsert(unsigned n, unsigned range, float threshold, std::vector<std::mutex> &locks,
-                                         Index::SimpleNeighbor *cut_graph_) {
-        Index::SimpleNeighbor *src_pool = cut_graph_ + (size_t) n * (size_t) range;
-        for (size_t i = 0; i < range; i++) {
-            if (src_pool[i].distance == -1) break;
-
-            Index::SimpleNeighbor sn(n, src_pool[i].distance);
-            size_t des = src_pool[i].id;
-            Index::SimpleNeighbor *des_pool = cut_graph_ + des * (size_t) range;
+    void ComponentRefineSSG::InterInsert(unsigned n, unsigned range, std::vector<Index::SimpleNeighbor> &pool,
+                                         std::vector<Index::SimpleNeighbor> &result) {
+        double kPi = std::acos(-1);
+        float threshold = std::cos(index->A / 180 * kPi);
 
-            std::vector<Index::SimpleNeighbor> temp_pool;
-            int dup = 0;
-            {
-                Index::LockGuard guard(locks[des]);
-                for (size_t j = 0; j < range; j++) {
-                    if (des_pool[j].distance == -1) break;
-                    if (n == des_pool[j].id) {
-                        dup = 1;
-                        break;
-                    }
-                    temp_pool.push_back(des_pool[j]);
-                }
-            }
-            if (dup) continue;
-
-            temp_pool.push_back(sn);
-            if (temp_pool.size() > range) {
-                std::vector<Index::SimpleNeighbor> result;
-                unsigned start = 0;
-                std::sort(temp_pool.begin(), temp_pool.end());
-                result.push_back(temp_pool[start]);
-                while (result.size() < range && (++start) < temp_pool.size()) {
-                    auto &p = temp_pool[start];
-                    bool occlude = false;
-                    for (unsigned t = 0; t < result.size(); t++) {
-                        if (p.id == result[t].id) {
-                            occlude = true;
-                            break;
-                        }
-                        float djk = index->getDist()->compare(
-                                index->getBaseData() + index->getBaseDim() * (size_t) result[t].id,
-                                index->getBaseData() + index->getBaseDim() * (size_t) p.id,
-                                (unsigned) index->getBaseDim());
-                        float cos_ij = (p.distance + result[t].distance - djk) / 2 /
-                                       sqrt(p.distance * result[t].distance);
-                        if (cos_ij > threshold) {
-                            occlude = true;
-                            break;
-                        }
-                    }
-                    if (!occlude) result.push_back(p);
-                }
-                {
-                    Index::LockGuard guard(locks[des]);
-                    for (unsigned t = 0; t < result.size(); t++) {
-                        des_pool[t] = result[t];
-                    }
-                    if (result.size() < range) {
-                        des_pool[result.size()].distance = -1;
-                    }
+        unsigned start = 0;
+        result.push_back(pool[start]);
+        while (result.size() < range && (++start) < pool.size()) {
+            auto &p = pool[start];
+            bool occlude = false;
+            for (unsigned t = 0; t < result.size(); t++) {
+                if (p.id == result[t].id) {
+                    occlude = true;
+                    break;
                 }
-            } else {
-                Index::LockGuard guard(locks[des]);
-                for (unsigned t = 0; t < range; t++) {
-                    if (des_pool[t].distance == -1) {
-                        des_pool[t] = sn;
-                        if (t + 1 < range) des_pool[t + 1].distance = -1;
-                        break;
-                    }
+                float djk = index->getDist()->compare(
+                        index->getBaseData() + index->getBaseDim() * (size_t) result[t].id,
+                        index->getBaseData() + index->getBaseDim() * (size_t) p.id,
+                        (unsigned) index->getBaseDim());
+                float cos_ij = (p.distance + result[t].distance - djk) / 2 /
+                               sqrt(p.distance * result[t].distance);
+                if (cos_ij > threshold) {
+                    occlude = true;
+                    break;
                 }
             }
+            if (!occlude) result.push_back(p);
         }
     }
 
@@ -678,25 +701,7 @@ namespace weavess {
      */
     void ComponentRefineDPG::RefineInner() {
         SetConfigs();
-        auto *cut_graph_ = new Index::SimpleNeighbor[index->getBaseLen() * (size_t) index->L_dpg];
-        Link(cut_graph_);
-
-        index->getFinalGraph().resize(index->getBaseLen());
-
-        for (size_t i = 0; i < index->getBaseLen(); i++) {
-            Index::SimpleNeighbor *pool = cut_graph_ + i * (size_t) index->L_dpg;
-            unsigned pool_size = 0;
-            for (unsigned j = 0; j < index->L_dpg; j++) {
-                if (pool[j].distance == -1) break;
-                pool_size = j;
-            }
-            pool_size++;
-            index->getFinalGraph()[i].resize(pool_size);
-            for (unsigned j = 0; j < pool_size; j++) {
-                Index::SimpleNeighbor nn(pool[j].id, pool[j].distance);
-                index->getFinalGraph()[i][j] = nn;
-            }
-        }
+        Link();
 
         // CONN
         // std::cout << "__CONN : DFS__" << std::endl;
@@ -714,23 +719,15 @@ namespace weavess {
         index->L_dpg = index->K / 2;
     }
 
-    void ComponentRefineDPG::Link(Index::SimpleNeighbor *cut_graph_) {
-        std::vector<std::mutex> locks(index->getBaseLen());
-
+    // 裁边只读取结点自身的邻居，直接写回该行并按实际邻居数重新分配，不需要 N * L_dpg 的裁边缓冲
+    void ComponentRefineDPG::Link() {
         // PRUNE
         ComponentPrune *b = new ComponentPruneDPG(index);
 
-#pragma omp parallel
-        {
-            boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
-#pragma omp for schedule(dynamic, 100)
-            for (unsigned n = 0; n < index->getBaseLen(); ++n) {
-                //std::cout << n << std::endl;
-
-                flags.reset();
-
-                b->PruneInner(n, index->L_dpg, flags, index->getFinalGraph()[n], cut_graph_);
-            }
+#pragma omp parallel for schedule(dynamic, 100)
+        for (unsigned n = 0; n < index->getBaseLen(); ++n) {
+            b->PruneToRange(index->L_dpg, index->getFinalGraph()[n]);
+            index->getFinalGraph()[n].shrink_to_fit();
         }
     }
 
@@ -749,24 +746,8 @@ namespace weavess {
         auto *a = new ComponentRefineEntryCentroid(index);
         a->EntryInner();
 
-        auto *cut_graph_ = new Index::SimpleNeighbor[index->getBaseLen() * (size_t) index->R_refine];
-        Link(cut_graph_);
-
-        index->getFinalGraph().resize(index->getBaseLen());
-
+        Link();
         for (size_t i = 0; i < index->getBaseLen(); i++) {
-            Index::SimpleNeighbor *pool = cut_graph_ + i * (size_t) index->R_refine;
-            unsigned pool_size = 0;
-            for (unsigned j = 0; j < index->R_refine; j++) {
-                if (pool[j].distance == -1) break;
-                pool_size = j;
-            }
-            pool_size++;
-            index->getFinalGraph()[i].resize(pool_size);
-            for (unsigned j = 0; j < pool_size; j++) {
-                Index::SimpleNeighbor nn(pool[j].id, pool[j].distance);
-                index->getFinalGraph()[i][j] = nn;
-            }
             std::sort(index->getFinalGraph()[i].begin(), index->getFinalGraph()[i].end());
         }
 
@@ -783,8 +764,8 @@ namespace weavess {
         index->R_refine = index->getParam().get<unsigned>("R_refine");
     }
 
-    void ComponentRefineVAMANA::Link(Index::SimpleNeighbor *cut_graph_) {
-        std::vector<std::mutex> locks(index->getBaseLen());
+    // 与 NSG 相同，裁边结果写入按实际邻居数分配的新图，完成后替换 FinalGraph
+    void ComponentRefineVAMANA::Link() {
 
         std::cout << "alpha " << index->alpha << std::endl;
 
@@ -796,114 +777,69 @@ namespace weavess {
         std::cout << "__PRUNE : VAMANA__" << std::endl;
         ComponentPrune *b = new ComponentPruneVAMANA(index);
 
+        std::vector<std::vector<Index::SimpleNeighbor>> cut_graph(index->getBaseLen());
 #pragma omp parallel
         {
             std::vector<Index::SimpleNeighbor> pool;
             pool.resize(index->getBaseLen());
-            boost::dynamic_bitset<> flags(index->getBaseLen(), 0);
+            std::vector<Index::SimpleNeighbor> des_pool(index->R_refine);
+            Index::BuildScratch scratch(index->getBaseLen());
 
 #pragma omp for schedule(dynamic, 100)
             for (unsigned n = 0; n < index->getBaseLen(); ++n) {
                 pool.clear();
-                flags.reset();
-                a->CandidateInner(n, index->ep_, flags, pool);
+                scratch.reset();
+                a->CandidateInner(n, index->ep_, scratch, pool);
 
-                b->PruneInner(n, index->R_refine, flags, pool, cut_graph_);
+                b->PruneInner(n, index->R_refine, scratch, pool, des_pool.data());
+                CopyPruned(index->R_refine, des_pool.data(), cut_graph[n]);
             }
         }
+        index->getFinalGraph().swap(cut_graph);
+        std::vector<std::vector<Index::SimpleNeighbor>>().swap(cut_graph);
 
-#pragma omp for schedule(dynamic, 100)
-        for (unsigned n = 0; n < index->getBaseLen(); ++n) {
-            InterInsert(n, index->R_refine, locks, cut_graph_);
-        }
+        ReverseLink(index->R_refine);
 
         // set step 2 alpha
         index->alpha = 2;
     }
 
-    void ComponentRefineVAMANA::InterInsert(unsigned int n, unsigned int range, std::vector<std::mutex> &locks,
-                                            Index::SimpleNeighbor *cut_graph_) {
-        // 结点 n 近邻
-        Index::SimpleNeighbor *src_pool = cut_graph_ + (size_t) n * (size_t) range;
-        // 遍历近邻
-        for (size_t i = 0; i < range; i++) {
-            if (src_pool[i].distance == -1) break;
-
-            Index::SimpleNeighbor sn(n, src_pool[i].distance);
-            size_t des = src_pool[i].id;
-            // 结点 n 近 des 邻信息
-            Index::SimpleNeighbor *des_pool = cut_graph_ + des * (size_t) range;
-
-            // 单向边近邻 （n -> des.nn)
-            std::vector<Index::SimpleNeighbor> temp_pool;
-            // 查询 res 与 des近邻 是否存在双向边
-            int dup = 0;
-            {
-                Index::LockGuard guard(locks[des]);
-                for (size_t j = 0; j < range; j++) {
-                    if (des_pool[j].distance == -1) break;
-                    if (n == des_pool[j].id) {
-                        dup = 1;
-                        break;
-                    }
-                    temp_pool.push_back(des_pool[j]);
+    void ComponentRefineVAMANA::InterInsert(unsigned int n, unsigned int range,
+                                            std::vector<Index::SimpleNeighbor> &pool,
+                                            std::vector<Index::SimpleNeighbor> &result) {
+        Index::MinHeap<float, Index::SimpleNeighbor> skipped;
+
+        for (size_t k = 0; k < pool.size(); k++) {
+            bool skip = false;
+            float cur_dist = pool[k].distance;
+            for (size_t j = 0; j < result.size(); j++) {
+                if (result[j].id == pool[k].id) {
+                    skip = true;
+                    break;
                 }
-            }
-            if (dup) continue;
-
-            // 插入待查询点 n
-            temp_pool.push_back(sn);
-            if (temp_pool.size() > range) {
-                // 裁边
-                std::vector<Index::SimpleNeighbor> result;
-                Index::MinHeap<float, Index::SimpleNeighbor> skipped;
-                std::sort(temp_pool.begin(), temp_pool.end());
-
-                for (int k = temp_pool.size() - 1; k >= 0; --k) {
-                    bool skip = false;
-                    float cur_dist = temp_pool[i].distance;
-                    for (size_t j = 0; j < result.size(); j++) {
-                        float dist = index->getDist()->compare(
-                                index->getBaseData() + index->getBaseDim() * (size_t) result[j].id,
-                                index->getBaseData() + index->getBaseDim() * (size_t) temp_pool[k].id,
-                                (unsigned) index->getBaseDim());
-                        if (index->alpha * dist < cur_dist) {
-                            skip = true;
-                            break;
-                        }
-                    }
-
-                    if (!skip) {
-                        result.push_back(temp_pool[k]);
-                    } else {
-                        skipped.push(cur_dist, temp_pool[k]);
-                    }
-
-                    if (result.size() == range)
-                        break;
+                float dist = index->getDist()->compare(
+                        index->getBaseData() + index->getBaseDim() * (size_t) result[j].id,
+                        index->getBaseData() + index->getBaseDim() * (size_t) pool[k].id,
+                        (unsigned) index->getBaseDim());
+                if (index->alpha * dist < cur_dist) {
+                    skip = true;
+                    break;
                 }
+            }
 
-                while (result.size() < range && skipped.size()) {
-                    result.push_back(skipped.top().data);
-                    skipped.pop();
-                }
-                {
-                    Index::LockGuard guard(locks[des]);
-                    for (unsigned t = 0; t < result.size(); t++) {
-                        des_pool[t] = result[t];
-                    }
-                }
+            if (!skip) {
+                result.push_back(pool[k]);
             } else {
-                // 添加反向边
-                Index::LockGuard guard(locks[des]);
-                for (unsigned t = 0; t < range; t++) {
-                    if (des_pool[t].distance == -1) {
-                        des_pool[t] = sn;
-                        if (t + 1 < range) des_pool[t + 1].distance = -1;
-                        break;
-                    }
-                }
+                skipped.push(cur_dist, pool[k]);
             }
+
+            if (result.size() == range)
+                break;
+        }
+
+        while (result.size() < range && skipped.size()) {
+            result.push_back(skipped.top().data);
+            skipped.pop();
         }
     }
 
@@ -960,6 +896,7 @@ namespace weavess {
     }
 
     void ComponentRefineEFANNA::init() {
+        index->nhood_locks_.resize(StripedLocks::StripesForThreads(index->n_threads_));
         index->graph_.reserve(index->getBaseLen());
         std::mt19937 rng(rand());
 
@@ -1012,8 +949,14 @@ namespace weavess {
                                                            index->getBaseData() + j * index->getBaseDim(),
                                                            index->getBaseDim());
 
-                    index->graph_[i].insert(j, dist);
-                    index->graph_[j].insert(i, dist);
+                    {
+                        Index::LockGuard guard(index->nhood_locks_[i]);
+                        index->graph_[i].insert(j, dist);
+                    }
+                    {
+                        Index::LockGuard guard(index->nhood_locks_[j]);
+                        index->graph_[j].insert(i, dist);
+                    }
                 }
             });
         }
@@ -1062,7 +1005,7 @@ namespace weavess {
                 if (nn.flag) {
                     nn_new.push_back(nn.id);
                     if (nn.distance > nhood_o.pool.back().distance) {
-                        Index::LockGuard guard(nhood_o.lock);
+                        Index::LockGuard guard(index->nhood_locks_[nn.id]);
                         if (nhood_o.rnn_new.size() < index->R)nhood_o.rnn_new.push_back(n);
                         else {
                             unsigned int pos = rand() % index->R;
@@ -1073,7 +1016,7 @@ namespace weavess {
                 } else {
                     nn_old.push_back(nn.id);
                     if (nn.distance > nhood_o.pool.back().distance) {
-                        Index::LockGuard guard(nhood_o.lock);
+                        Index::LockGuard guard(index->nhood_locks_[nn.id]);
                         if (nhood_o.rnn_old.size() < index->R)nhood_o.rnn_old.push_back(n);
                         else {
                             unsigned int pos = rand() % index->R;
@@ -1130,9 +1073,9 @@ namespace weavess {
     float mean_acc=0;
     for(unsigned i=0; i<ctrl_points.size(); i++){
         float acc = 0;
-        auto &g = index->graph_[ctrl_points[i]].pool;
+        const Index::Neighbor *g = index->flat_graph_.pool(ctrl_points[i]);
         auto &v = acc_eval_set[i];
-        for(unsigned j=0; j<g.size(); j++){
+        for(unsigned j=0; j<index->flat_graph_.pool_size[ctrl_points[i]]; j++){
         for(unsigned k=0; k<v.size(); k++){
             if(g[j].id == v[k]){
             acc++;
@@ -1321,6 +1264,7 @@ namespace weavess {
                 index->getFinalGraph()[i].resize(pool_size);
             }
         }
+        delete[] cut_graph_;
 
 //        for(int i = 0; i < 10; i ++) {
 //            std::cout << i << " " << index->getFinalGraph()[i].size() << std::endl;
@@ -1353,6 +1297,7 @@ namespace weavess {
                 index->getFinalGraph()[i].resize(pool_size);
             }
         }
+        delete[] cut_graph2_;
 
         for(int i = 0; i < 10; i ++) {
             std::cout << i << " " << index->getFinalGraph()[i].size() << std::endl;
@@ -1364,8 +1309,6 @@ namespace weavess {
     }
 
     void ComponentRefineSPTAG_BKT::Link(Index::SimpleNeighbor *cut_graph_) {
-        std::vector<std::mutex> locks(index->getBaseLen());
-
         // CANDIDATE
         std::cout << "__CANDIDATE : SPTAG_BKT__" << std::endl;
         auto *a = new ComponentCandidateSPTAG_BKT(index);
@@ -1377,17 +1320,17 @@ namespace weavess {
 #pragma omp parallel
         {
             std::vector<Index::SimpleNeighbor> pool;
-            boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
+            Index::BuildScratch scratch(index->getBaseLen());
 
 #pragma omp for schedule(dynamic, 100)
             for (unsigned n = 0; n < index->getBaseLen(); ++n) {
                 //std::cout << n << std::endl;
                 pool.clear();
-                flags.reset();
+                scratch.reset();
 
-                a->CandidateInner(n, index->ep_, flags, pool);
+                a->CandidateInner(n, index->ep_, scratch, pool);
                 //std::cout << n << " candidate : " << pool.size() << std::endl;
-                b->PruneInner(n, index->R_refine, flags, pool, cut_graph_);
+                b->PruneInner(n, index->R_refine, scratch, pool, cut_graph_ + (size_t) n * index->R_refine);
                 //std::cout << n << " prune : " << pool.size() << " " << index->R_refine << std::endl;
             }
 
@@ -1420,6 +1363,7 @@ namespace weavess {
                 index->getFinalGraph()[i].resize(pool_size);
             }
         }
+        delete[] cut_graph_;
 
 //        for(int i = 0; i < 10; i ++) {
 //            std::cout << i << " " << index->getFinalGraph()[i].size() << std::endl;
@@ -1452,6 +1396,7 @@ namespace weavess {
                 index->getFinalGraph()[i].resize(pool_size);
             }
         }
+        delete[] cut_graph2_;
 
 //        for(int i = 0; i < 10; i ++) {
 //            std::cout << i << " " << index->getFinalGraph()[i].size() << std::endl;
@@ -1463,8 +1408,6 @@ namespace weavess {
     }
 
     void ComponentRefineSPTAG_KDT::Link(Index::SimpleNeighbor *cut_graph_) {
-        std::vector<std::mutex> locks(index->getBaseLen());
-
         // CANDIDATE
         std::cout << "__CANDIDATE : SPTAG_KDT__" << std::endl;
         auto *a = new ComponentCandidateSPTAG_KDT(index);
@@ -1476,19 +1419,19 @@ namespace weavess {
 #pragma omp parallel
         {
             std::vector<Index::SimpleNeighbor> pool;
-            boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
+            Index::BuildScratch scratch(index->getBaseLen());
 
 #pragma omp for schedule(dynamic, 100)
             for (unsigned n = 0; n < index->getBaseLen(); ++n) {
                 pool.clear();
-                flags.reset();
+                scratch.reset();
 
-                a->CandidateInner(n, n, flags, pool);
+                a->CandidateInner(n, n, scratch, pool);
 //                for(int i = 0; i < pool.size(); i ++)
 //                    std::cout << pool[i].id << "|" << pool[i].distance << " ";
                 //std::cout << "candidate finish" << std::endl;
                 //std::cout << n << " candidate : " << pool.size() << std::endl;
-                b->PruneInner(n, index->R_refine, flags, pool, cut_graph_);
+                b->PruneInner(n, index->R_refine, scratch, pool, cut_graph_ + (size_t) n * index->R_refine);
                 //std::cout << "prune finish" << std::endl;
                 //std::cout << n << " prune : " << pool.size() << std::endl;
             }
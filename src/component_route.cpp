@@ -3,135 +3,510 @@
 //
 
 #include "weavess/component.h"
+#include <aio.h>
 
 namespace weavess {
 
+    // 当前线程复用的访问标记，至少 num 份，每份覆盖 size 个点
+    static std::vector<std::unique_ptr<Index::VisitedList>> &GetVisitedLists(unsigned num, unsigned size) {
+        static thread_local std::vector<std::unique_ptr<Index::VisitedList>> lists;
+        if (lists.size() < num) lists.resize(num);
+        for (unsigned i = 0; i < num; i++) {
+            if (!lists[i] || lists[i]->GetSize() != size) lists[i].reset(new Index::VisitedList(size));
+        }
+        return lists;
+    }
+
+    /**
+     * 范围搜索：以路由的 K_search 个近邻为种子，从中距离不超过 explorationCoefficient * radius 的点出发按距离由近及远扩展，
+     * 只继续扩展同样落在该界内的邻居，收集所有距离不超过 radius 的点
+     * @param query 查询点
+     * @param pool 入口点
+     * @param radius 半径，与距离同量纲（L2 平方）
+     * @param cap 结果个数上限，达到后停止扩展，0 表示不限
+     * @param res 结果，按距离升序
+     */
+    void ComponentSearchRoute::RangeSearch(unsigned query, std::vector<Index::Neighbor> &pool, float radius,
+                                           unsigned cap, std::vector<Index::SimpleNeighbor> &res) {
+        const auto K = index->getParam().get<unsigned>("K_search");
+        const unsigned dim = index->getBaseDim();
+        std::vector<unsigned> ids(K, -1);
+        std::vector<float> dists(K, std::numeric_limits<float>::max());
+        RouteInner(query, pool, ids.data(), dists.data());
+
+        // 路由使用第 0 份访问标记，扩展阶段使用第 1 份
+        Index::VisitedList *visited_list = GetVisitedLists(2, index->getBaseLen())[1].get();
+        visited_list->Reset();
+
+        typedef std::pair<float, unsigned> DistId;
+        std::priority_queue<DistId, std::vector<DistId>, std::greater<DistId>> frontier;
+        const float bound = index->explorationCoefficient * radius;
+        res.clear();
+        for (unsigned i = 0; i < K && ids[i] != (unsigned) -1; i++) {
+            visited_list->MarkAsVisited(ids[i]);
+            if (dists[i] <= radius) res.emplace_back(ids[i], dists[i]);
+            if (dists[i] <= bound) frontier.emplace(dists[i], ids[i]);
+        }
+
+        const float *query_data = index->getQueryData() + (size_t) query * index->getQueryDim();
+        std::vector<unsigned> neighbors;
+        unsigned dist_count = 0, hop_count = 0;
+        while (!frontier.empty() && (cap == 0 || res.size() < cap)) {
+            unsigned n = frontier.top().second;
+            frontier.pop();
+            hop_count++;
+
+            GetNeighbors(n, neighbors);
+            for (unsigned id : neighbors) {
+                if (visited_list->Visited(id)) continue;
+                visited_list->MarkAsVisited(id);
+
+                float dist = index->getDist()->compare(query_data, index->getBaseData() + (size_t) id * dim, dim);
+                dist_count++;
+                if (dist <= radius) res.emplace_back(id, dist);
+                if (dist <= bound) frontier.emplace(dist, id);
+            }
+        }
+
+        index->addDistCount(dist_count);
+        index->addHopCount(hop_count);
+
+        std::sort(res.begin(), res.end());
+        if (cap != 0 && res.size() > cap) res.resize(cap);
+    }
+
+    void ComponentSearchRoute::GetNeighbors(unsigned id, std::vector<unsigned> &neighbors) {
+        neighbors.clear();
+        if (!index->getLoadGraph().empty()) {
+            neighbors = index->getLoadGraph()[id];
+        } else if (!index->getFinalGraph().empty()) {
+            for (const auto &nn : index->getFinalGraph()[id]) {
+                // SPTAG 以负 id 作为结束或树结点标记
+                if (nn.id < index->getBaseLen()) neighbors.push_back(nn.id);
+            }
+        } else {
+            std::cerr << "range search requires an in-memory graph" << std::endl;
+            exit(-1);
+        }
+    }
+
+    /**
+     * 过滤搜索：filter 为基础向量上的位图，只返回对应位为 1 的点。满足条件的点不超过 filter_brute_force_num
+     * （默认 2000）时直接暴力搜索，否则由路由在遍历中过滤
+     * @param query 查询点
+     * @param pool 入口点
+     * @param filter 过滤位图，长度为基础向量个数
+     * @param match_num filter 中为 1 的位数
+     * @param ids 结果 id
+     * @param dists 结果距离
+     */
+    void ComponentSearchRoute::FilteredSearch(unsigned query, std::vector<Index::Neighbor> &pool,
+                                              const boost::dynamic_bitset<> &filter, size_t match_num, unsigned *ids,
+                                              float *dists) {
+        if (filter.size() != index->getBaseLen()) {
+            std::cerr << "filter size does not match base data" << std::endl;
+            exit(-1);
+        }
+        if (match_num <= index->getParam().get<unsigned>("filter_brute_force_num", 2000)) {
+            BruteForceFiltered(query, filter, ids, dists);
+        } else {
+            RouteFiltered(query, pool, filter, ids, dists);
+        }
+    }
+
+    void ComponentSearchRoute::RouteFiltered(unsigned query, std::vector<Index::Neighbor> &pool,
+                                             const boost::dynamic_bitset<> &filter, unsigned *ids, float *dists) {
+        BruteForceFiltered(query, filter, ids, dists);
+    }
+
     /**
-     * 贪婪搜索
+     * 对满足过滤条件的点暴力计算距离
+     * @param query 查询点
+     * @param filter 过滤位图
+     * @param ids 结果 id
+     * @param dists 结果距离
+     */
+    void ComponentSearchRoute::BruteForceFiltered(unsigned query, const boost::dynamic_bitset<> &filter, unsigned *ids,
+                                                  float *dists) {
+        const auto K = index->getParam().get<unsigned>("K_search");
+        const unsigned dim = index->getBaseDim();
+        const float *query_data = index->getQueryData() + (size_t) query * index->getQueryDim();
+
+        Index::CandidatePool result(K);
+        unsigned dist_count = 0;
+        for (size_t id = filter.find_first(); id != boost::dynamic_bitset<>::npos; id = filter.find_next(id)) {
+            float dist = index->getDist()->compare(query_data, index->getBaseData() + id * dim, dim);
+            dist_count++;
+            if (dist < result.bound()) result.insert((unsigned) id, dist);
+        }
+        index->addDistCount(dist_count);
+
+        for (unsigned i = 0; i < result.size(); i++) {
+            ids[i] = result.id(i);
+            dists[i] = result.distance(i);
+        }
+    }
+
+    /**
+     * 贪婪搜索，设置 early_stop_patience / early_stop_ratio 时在前 K 个结果趋于稳定后提前终止
      * @param query 查询点
      * @param pool 侯选池
-     * @param res 结果集
+     * @param ids 结果 id
+     * @param dists 结果距离
+     * @return 是否因搜索预算耗尽而截断
      */
-    void ComponentSearchRouteGreedy::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool,
-                                                std::vector<unsigned int> &res) {
+    bool ComponentSearchRouteGreedy::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                                float *dists) {
         const auto L = index->getParam().get<unsigned>("L_search");
         const auto K = index->getParam().get<unsigned>("K_search");
 
-        std::vector<char> flags(index->getBaseLen(), 0);
+        Index::VisitedList *visited_list = GetVisitedLists(1, index->getBaseLen())[0].get();
+        visited_list->Reset();
+        Index::CandidatePool candidates(L);
+        for (unsigned i = 0; i < L && i < pool.size(); i++) {
+            unsigned id = pool[i].id;
+            if (id >= index->getBaseLen() || visited_list->Visited(id)) continue;
+            visited_list->MarkAsVisited(id);
+            candidates.insert(id, pool[i].distance, !pool[i].flag);
+        }
 
-        int k = 0;
-        while (k < (int) L) {
-            int nk = L;
+        const float *query_data = index->getQueryData() + index->getQueryDim() * query;
+        Index::SearchBudget budget = GetBudget();
+        Index::EarlyStop early_stop = GetEarlyStop(K);
+        unsigned dist_count = 0, hop_count = 0;
+        while (candidates.has_unexpanded() && !early_stop.stop(candidates) && !budget.exhausted(dist_count)) {
+            unsigned n = candidates.pop();
+            hop_count++;
+            bool changed = false;
 
-            if (pool[k].flag) {
-                pool[k].flag = false;
-                unsigned n = pool[k].id;
+            // 查找邻居的邻居
+            for (unsigned m = 0; m < index->getLoadGraph()[n].size(); ++m) {
+                unsigned id = index->getLoadGraph()[n][m];
 
-                // 查找邻居的邻居
-                for (unsigned m = 0; m < index->getLoadGraph()[n].size(); ++m) {
-                    unsigned id = index->getLoadGraph()[n][m];
+                if (visited_list->Visited(id))continue;
+                visited_list->MarkAsVisited(id);
 
-                    if (flags[id])continue;
-                    flags[id] = 1;
+                float dist = index->getDist()->compare(query_data, index->getBaseData() + index->getBaseDim() * id,
+                                                       (unsigned) index->getBaseDim());
+                dist_count++;
 
-                    float dist = index->getDist()->compare(index->getQueryData() + index->getQueryDim() * query,
-                                                           index->getBaseData() + index->getBaseDim() * id,
-                                                           (unsigned) index->getBaseDim());
-                    index->addDistCount();
+                if (dist >= candidates.bound()) continue;
+                if (candidates.insert(id, dist) < K) changed = true;
+            }
+            early_stop.update(changed);
+        }
 
-                    if (dist >= pool[L - 1].distance) continue;
-                    Index::Neighbor nn(id, dist, true);
-                    int r = Index::InsertIntoPool(pool.data(), L, nn);
+        index->addDistCount(dist_count);
+        index->addHopCount(hop_count);
 
-                    //if(L+1 < retset.size()) ++L;
-                    if (r < nk)nk = r;
+        for (unsigned i = 0; i < K && i < candidates.size(); i++) {
+            ids[i] = candidates.id(i);
+            dists[i] = candidates.distance(i);
+        }
+        return budget.truncated();
+    }
+
+
+    /**
+     * 交错执行一组贪婪搜索：每个查询是一个无栈协程，扩展候选前先预取其邻接表，回到该查询时再预取未访问邻居的向量，
+     * 第三次轮到时才计算距离，等待内存期间由其他查询占用 CPU
+     * @param query_begin 首个查询点
+     * @param num 查询个数
+     * @param pools 各查询的候选池
+     * @param ids 结果 id
+     * @param dists 结果距离
+     * @param truncated 各查询是否因搜索预算耗尽而截断
+     */
+    void ComponentSearchRouteGreedy::RouteInterleaved(unsigned query_begin, unsigned num,
+                                                      std::vector<std::vector<Index::Neighbor>> &pools,
+                                                      unsigned *ids, float *dists, bool *truncated) {
+        const auto L = index->getParam().get<unsigned>("L_search");
+        const auto K = index->getParam().get<unsigned>("K_search");
+        const unsigned dim = index->getBaseDim();
+
+        enum Phase { FETCH, VISIT, COMPUTE, DONE };
+        struct Task {
+            Index::CandidatePool candidates;
+            Index::VisitedList *visited;
+            Index::SearchBudget budget;
+            Index::EarlyStop early_stop;
+            unsigned dist_count;
+            const float *query;
+            unsigned node;
+            std::vector<unsigned> todo;
+            Phase phase;
+        };
+
+        auto &visited_lists = GetVisitedLists(num, index->getBaseLen());
+        std::vector<Task> tasks(num);
+        for (unsigned i = 0; i < num; i++) {
+            Task &t = tasks[i];
+            t.candidates.reset(L);
+            t.visited = visited_lists[i].get();
+            t.visited->Reset();
+            t.budget = GetBudget();
+            t.early_stop = GetEarlyStop(K);
+            t.dist_count = 0;
+            t.query = index->getQueryData() + (size_t) (query_begin + i) * index->getQueryDim();
+            t.phase = FETCH;
+            for (unsigned j = 0; j < L && j < pools[i].size(); j++) {
+                unsigned id = pools[i][j].id;
+                if (id >= index->getBaseLen() || t.visited->Visited(id)) continue;
+                t.visited->MarkAsVisited(id);
+                t.candidates.insert(id, pools[i][j].distance, !pools[i][j].flag);
+            }
+        }
+
+        unsigned dist_count = 0, hop_count = 0;
+        unsigned active = num;
+        while (active > 0) {
+            for (unsigned i = 0; i < num; i++) {
+                Task &t = tasks[i];
+                switch (t.phase) {
+                    case COMPUTE: {
+                        bool changed = false;
+                        for (unsigned id : t.todo) {
+                            float dist = index->getDist()->compare(t.query, index->getBaseData() + (size_t) id * dim,
+                                                                   dim);
+                            t.dist_count++;
+                            if (dist >= t.candidates.bound()) continue;
+                            if (t.candidates.insert(id, dist) < K) changed = true;
+                        }
+                        t.early_stop.update(changed);
+                    }
+                        // fall through
+                    case FETCH:
+                        if (!t.candidates.has_unexpanded() || t.early_stop.stop(t.candidates)
+                            || t.budget.exhausted(t.dist_count)) {
+                            for (unsigned j = 0; j < K && j < t.candidates.size(); j++) {
+                                ids[(size_t) i * K + j] = t.candidates.id(j);
+                                dists[(size_t) i * K + j] = t.candidates.distance(j);
+                            }
+                            truncated[i] = t.budget.truncated();
+                            dist_count += t.dist_count;
+                            t.phase = DONE;
+                            active--;
+                            break;
+                        }
+                        t.node = t.candidates.pop();
+                        hop_count++;
+                        Index::Prefetch(index->getLoadGraph()[t.node].data(),
+                                        index->getLoadGraph()[t.node].size() * sizeof(unsigned));
+                        t.phase = VISIT;
+                        break;
+                    case VISIT:
+                        t.todo.clear();
+                        for (unsigned id : index->getLoadGraph()[t.node]) {
+                            if (t.visited->Visited(id)) continue;
+                            t.visited->MarkAsVisited(id);
+                            t.todo.push_back(id);
+                            Index::Prefetch(index->getBaseData() + (size_t) id * dim, dim * sizeof(float));
+                        }
+                        t.phase = COMPUTE;
+                        break;
+                    case DONE:
+                        break;
                 }
-                //lock to here
             }
-            if (nk <= k)k = nk;
-            else ++k;
         }
 
-        res.resize(K);
-        for (size_t i = 0; i < K; i++) {
-            res[i] = pool[i].id;
+        index->addDistCount(dist_count);
+        index->addHopCount(hop_count);
+    }
+
+
+    /**
+     * 用入口点初始化可续搜状态
+     * @param pool 入口点组件给出的候选池（L_search 个）
+     * @param state 搜索状态
+     */
+    void ComponentSearchRouteGreedy::InitState(std::vector<Index::Neighbor> &pool, Index::SearchState &state) {
+        const auto L = index->getParam().get<unsigned>("L_search");
+
+        state.pool.reset(L);
+        state.spill.clear();
+        state.flags.assign(index->getBaseLen(), 0);
+        for (unsigned i = 0; i < L && i < pool.size(); i++) {
+            unsigned id = pool[i].id;
+            if (id >= index->getBaseLen() || state.flags[id]) continue;
+            state.flags[id] = 1;
+            state.pool.insert(id, pool[i].distance, !pool[i].flag);
         }
     }
 
+    /**
+     * 可续搜的贪婪搜索：将候选池扩至 L，放回此前被拒绝或挤出的候选，只扩展尚未扩展的候选。
+     * 按 L 递增调用时，总开销约等于直接以最大 L 搜索一次
+     * @param query 查询点
+     * @param L 本次候选池大小，不小于上次
+     * @param state 搜索状态
+     * @param res 结果 id
+     */
+    void ComponentSearchRouteGreedy::RouteResume(unsigned query, unsigned L, Index::SearchState &state,
+                                                 std::vector<unsigned> &res) {
+        const auto K = index->getParam().get<unsigned>("K_search");
+
+        Index::CandidatePool &pool = state.pool;
+        pool.grow(L);
+
+        // 插入候选池，被拒绝或挤出池尾的候选留待下次扩容
+        auto insert = [&](unsigned id, float dist, bool expanded) {
+            if (dist >= pool.bound()) {
+                state.spill.emplace_back(id, dist, !expanded);
+                return;
+            }
+            bool evict = pool.full();
+            Index::Neighbor last = evict ? Index::Neighbor(pool.id(pool.size() - 1), pool.distance(pool.size() - 1),
+                                                           !pool.expanded(pool.size() - 1))
+                                         : Index::Neighbor();
+            if (pool.insert(id, dist, expanded) < pool.capacity() && evict) state.spill.push_back(last);
+        };
+
+        std::vector<Index::Neighbor> spill;
+        spill.swap(state.spill);
+        for (auto &nn : spill) {
+            insert(nn.id, nn.distance, !nn.flag);
+        }
+
+        const float *query_data = index->getQueryData() + index->getQueryDim() * query;
+        while (pool.has_unexpanded()) {
+            unsigned n = pool.pop();
+            index->addHopCount();
+
+            for (unsigned m = 0; m < index->getLoadGraph()[n].size(); ++m) {
+                unsigned id = index->getLoadGraph()[n][m];
+
+                if (state.flags[id])continue;
+                state.flags[id] = 1;
+
+                float dist = index->getDist()->compare(query_data, index->getBaseData() + index->getBaseDim() * id,
+                                                       (unsigned) index->getBaseDim());
+                index->addDistCount();
+
+                insert(id, dist, false);
+            }
+        }
+
+        res.resize(std::min((unsigned) K, pool.size()));
+        for (size_t i = 0; i < res.size(); i++) {
+            res[i] = pool.id(i);
+        }
+    }
 
     /**
-     * NSW 搜索
+     * 带过滤的贪婪搜索：候选池照常接纳所有点以保持导航，另以 K 容量的结果池只接纳满足过滤条件的点
      * @param query 查询点
-     * @param pool
-     * @param res 结果集
+     * @param pool 侯选池
+     * @param filter 过滤位图
+     * @param ids 结果 id
+     * @param dists 结果距离
      */
-    void ComponentSearchRouteNSW::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool,
-                                              std::vector<unsigned int> &res) {
+    void ComponentSearchRouteGreedy::RouteFiltered(unsigned query, std::vector<Index::Neighbor> &pool,
+                                                   const boost::dynamic_bitset<> &filter, unsigned *ids, float *dists) {
+        const auto L = index->getParam().get<unsigned>("L_search");
         const auto K = index->getParam().get<unsigned>("K_search");
+        const unsigned dim = index->getBaseDim();
+
+        Index::VisitedList *visited_list = GetVisitedLists(1, index->getBaseLen())[0].get();
+        visited_list->Reset();
+
+        Index::CandidatePool candidates(L), result(K);
+        for (unsigned i = 0; i < L && i < pool.size(); i++) {
+            unsigned id = pool[i].id;
+            if (id >= index->getBaseLen() || visited_list->Visited(id)) continue;
+            visited_list->MarkAsVisited(id);
+            candidates.insert(id, pool[i].distance, !pool[i].flag);
+            if (filter[id]) result.insert(id, pool[i].distance);
+        }
 
-        auto *visited_list = new Index::VisitedList(index->getBaseLen());
+        const float *query_data = index->getQueryData() + (size_t) query * index->getQueryDim();
+        unsigned dist_count = 0, hop_count = 0;
+        while (candidates.has_unexpanded()) {
+            unsigned n = candidates.pop();
+            hop_count++;
 
-        Index::HnswNode *enterpoint = index->enterpoint_;
-        std::priority_queue<Index::FurtherFirst> result;
-        std::priority_queue<Index::CloserFirst> tmp;
+            for (unsigned id : index->getLoadGraph()[n]) {
+                if (visited_list->Visited(id)) continue;
+                visited_list->MarkAsVisited(id);
 
-        SearchAtLayer(query, enterpoint, 0, visited_list, result);
+                float dist = index->getDist()->compare(query_data, index->getBaseData() + (size_t) id * dim, dim);
+                dist_count++;
 
-        while(!result.empty()) {
-            tmp.push(Index::CloserFirst(result.top().GetNode(), result.top().GetDistance()));
-            result.pop();
+                if (filter[id] && dist < result.bound()) result.insert(id, dist);
+                if (dist < candidates.bound()) candidates.insert(id, dist);
+            }
         }
 
-        res.resize(K);
-        int pos = 0;
-        while (!tmp.empty() && pos < K) {
-            auto *top_node = tmp.top().GetNode();
-            tmp.pop();
-            res[pos] = top_node->GetId();
-            pos ++;
+        index->addDistCount(dist_count);
+        index->addHopCount(hop_count);
+
+        for (unsigned i = 0; i < result.size(); i++) {
+            ids[i] = result.id(i);
+            dists[i] = result.distance(i);
         }
+    }
+
+    /**
+     * NSW 搜索
+     * @param query 查询点
+     * @param pool
+     * @param ids 结果 id
+     * @param dists 结果距离
+     * @return 是否因搜索预算耗尽而截断
+     */
+    bool ComponentSearchRouteNSW::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                             float *dists) {
+        const auto K = index->getParam().get<unsigned>("K_search");
+
+        Index::VisitedList *visited_list = GetVisitedLists(1, index->getBaseLen())[0].get();
+        Index::SearchBudget budget = GetBudget();
+
+        std::priority_queue<std::pair<float, unsigned>> result;
+        SearchAtLayer(query, 0, visited_list, budget, result);
 
-        delete visited_list;
+        while (result.size() > K) result.pop();
+        for (int i = (int) result.size() - 1; i >= 0; i--) {
+            ids[i] = result.top().second;
+            dists[i] = result.top().first;
+            result.pop();
+        }
+        return budget.truncated();
     }
 
-    void ComponentSearchRouteNSW::SearchAtLayer(unsigned qnode, Index::HnswNode *enterpoint, int level,
-                                         Index::VisitedList *visited_list,
-                                         std::priority_queue<Index::FurtherFirst> &result) {
+    void ComponentSearchRouteNSW::SearchAtLayer(unsigned qnode, unsigned enterpoint, Index::VisitedList *visited_list,
+                                                Index::SearchBudget &budget,
+                                                std::priority_queue<std::pair<float, unsigned>> &result) {
         const auto L = index->getParam().get<unsigned>("L_search");
 
-        // TODO: check Node 12bytes => 8bytes
-        std::priority_queue<Index::CloserFirst> candidates;
-        float d = index->getDist()->compare(index->getQueryData() + qnode * index->getQueryDim(),
-                                            index->getBaseData() + enterpoint->GetId() * index->getBaseDim(),
+        typedef std::pair<float, unsigned> DistId;
+        std::priority_queue<DistId, std::vector<DistId>, std::greater<DistId>> candidates;
+        const float *query = index->getQueryData() + (size_t) qnode * index->getQueryDim();
+        unsigned dist_count = 1, hop_count = 0;
+
+        float d = index->getDist()->compare(query, index->getBaseData() + (size_t) enterpoint * index->getBaseDim(),
                                             index->getBaseDim());
-        index->addDistCount();
-        result.emplace(enterpoint, d);
-        candidates.emplace(enterpoint, d);
+        result.emplace(d, enterpoint);
+        candidates.emplace(d, enterpoint);
 
         visited_list->Reset();
-        visited_list->MarkAsVisited(enterpoint->GetId());
+        visited_list->MarkAsVisited(enterpoint);
 
         while (!candidates.empty()) {
-            const Index::CloserFirst &candidate = candidates.top();
-            float lower_bound = result.top().GetDistance();
-            if (candidate.GetDistance() > lower_bound)
+            DistId candidate = candidates.top();
+            if (candidate.first > result.top().first || budget.exhausted(dist_count))
                 break;
-
-            Index::HnswNode *candidate_node = candidate.GetNode();
-            std::unique_lock<std::mutex> lock(candidate_node->GetAccessGuard());
-            const std::vector<Index::HnswNode *> &neighbors = candidate_node->GetFriends(level);
             candidates.pop();
-            for (const auto &neighbor : neighbors) {
-                int id = neighbor->GetId();
+            hop_count++;
+
+            for (unsigned id : index->nsw_links_[candidate.second]) {
                 if (visited_list->NotVisited(id)) {
                     visited_list->MarkAsVisited(id);
-                    d = index->getDist()->compare(index->getQueryData() + qnode * index->getQueryDim(),
-                                                  index->getBaseData() + neighbor->GetId() * index->getBaseDim(),
+                    d = index->getDist()->compare(query, index->getBaseData() + (size_t) id * index->getBaseDim(),
                                                   index->getBaseDim());
-                    index->addDistCount();
-                    if (result.size() < L || result.top().GetDistance() > d) {
-                        result.emplace(neighbor, d);
-                        candidates.emplace(neighbor, d);
+                    dist_count++;
+                    if (result.size() < L || result.top().first > d) {
+                        result.emplace(d, id);
+                        candidates.emplace(d, id);
                         if (result.size() > L)
                             result.pop();
                     }
@@ -139,7 +514,12 @@ namespace weavess {
             }
         }
 
+        index->addDistCount(dist_count);
+        index->addHopCount(hop_count);
+    }
 
+    void ComponentSearchRouteNSW::GetNeighbors(unsigned id, std::vector<unsigned> &neighbors) {
+        neighbors = index->nsw_links_[id];
     }
 
 
@@ -147,169 +527,306 @@ namespace weavess {
      * HNSW 搜索
      * @param query 查询点
      * @param pool
-     * @param res 结果集
+     * @param ids 结果 id
+     * @param dists 结果距离
+     * @return 是否因搜索预算耗尽而截断
      */
-    void ComponentSearchRouteHNSW::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool,
-                                              std::vector<unsigned int> &res) {
+    bool ComponentSearchRouteHNSW::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                              float *dists) {
         const auto K = index->getParam().get<unsigned>("K_search");
         const auto L = index->getParam().get<unsigned>("L_search");
 
-        auto *visited_list = new Index::VisitedList(index->getBaseLen());
+        Index::VisitedList *visited_list = GetVisitedLists(1, index->getBaseLen())[0].get();
 
-        Index::HnswNode *enterpoint = index->enterpoint_;
-        std::vector<std::pair<Index::HnswNode *, float>> ensure_k_path_;
+        const float *query_data = index->getQueryData() + (size_t) query * index->getQueryDim();
+        Index::SearchBudget budget = GetBudget();
+        float cur_dist;
+        unsigned cur_node = SearchUpperLayers(query_data, cur_dist);
 
-        Index::HnswNode *cur_node = enterpoint;
+        std::priority_queue<std::pair<float, unsigned>> result;
+        SearchAtLayer0(query_data, cur_node, cur_dist, std::max(L, K), visited_list, budget, result);
 
-        float d = index->getDist()->compare(index->getQueryData() + query * index->getQueryDim(),
-                                            index->getBaseData() + cur_node->GetId() * index->getBaseDim(),
-                                            index->getBaseDim());
-        index->addDistCount();
-        float cur_dist = d;
+        while (result.size() > K) result.pop();
+        for (int i = (int) result.size() - 1; i >= 0; i--) {
+            ids[i] = result.top().second;
+            dists[i] = result.top().first;
+            result.pop();
+        }
+        return budget.truncated();
+    }
 
-        ensure_k_path_.clear();
-        ensure_k_path_.emplace_back(cur_node, cur_dist);
+    /**
+     * 交错执行一组 HNSW 搜索：各查询先逐个完成上层下降，第 0 层的 ef 搜索作为无栈协程交错推进，
+     * 扩展候选前预取其邻接表，下一轮预取未访问邻居的向量，再下一轮计算距离
+     * @param query_begin 首个查询点
+     * @param num 查询个数
+     * @param pools 各查询的候选池（未使用）
+     * @param ids 结果 id
+     * @param dists 结果距离
+     * @param truncated 各查询是否因搜索预算耗尽而截断
+     */
+    void ComponentSearchRouteHNSW::RouteInterleaved(unsigned query_begin, unsigned num,
+                                                    std::vector<std::vector<Index::Neighbor>> &pools,
+                                                    unsigned *ids, float *dists, bool *truncated) {
+        const auto K = index->getParam().get<unsigned>("K_search");
+        const auto L = index->getParam().get<unsigned>("L_search");
+        const unsigned ef = std::max(L, K);
+        const unsigned dim = index->getBaseDim();
+
+        typedef std::pair<float, unsigned> DistId;
+        enum Phase { FETCH, VISIT, COMPUTE, DONE };
+        struct Task {
+            std::priority_queue<DistId> result;
+            std::priority_queue<DistId, std::vector<DistId>, std::greater<DistId>> candidates;
+            Index::VisitedList *visited;
+            Index::SearchBudget budget;
+            unsigned dist_count;
+            const float *query;
+            const unsigned *links;
+            std::vector<unsigned> todo;
+            Phase phase;
+        };
+
+        auto &visited_lists = GetVisitedLists(num, index->getBaseLen());
+        std::vector<Task> tasks(num);
+        for (unsigned i = 0; i < num; i++) {
+            Task &t = tasks[i];
+            t.query = index->getQueryData() + (size_t) (query_begin + i) * index->getQueryDim();
+            t.budget = GetBudget();
+            t.dist_count = 0;
+            float enter_dist;
+            unsigned enterpoint = SearchUpperLayers(t.query, enter_dist);
+            t.visited = visited_lists[i].get();
+            t.visited->Reset();
+            t.visited->MarkAsVisited(enterpoint);
+            t.result.emplace(enter_dist, enterpoint);
+            t.candidates.emplace(enter_dist, enterpoint);
+            t.phase = FETCH;
+        }
 
-        for (auto i = index->max_level_; i >= 0; --i) {
-            visited_list->Reset();
-            unsigned visited_mark = visited_list->GetVisitMark();
-            unsigned int* visited = visited_list->GetVisited();
-            visited[cur_node->GetId()] = visited_mark;
+        unsigned dist_count = 0, hop_count = 0;
+        unsigned active = num;
+        while (active > 0) {
+            for (unsigned i = 0; i < num; i++) {
+                Task &t = tasks[i];
+                switch (t.phase) {
+                    case COMPUTE:
+                        for (unsigned id : t.todo) {
+                            float d = index->getDist()->compare(t.query, index->getBaseData() + (size_t) id * dim, dim);
+                            t.dist_count++;
+                            if (t.result.size() < ef || d < t.result.top().first) {
+                                t.candidates.emplace(d, id);
+                                t.result.emplace(d, id);
+                                if (t.result.size() > ef) t.result.pop();
+                            }
+                        }
+                        // fall through
+                    case FETCH:
+                        if (t.candidates.empty() || t.candidates.top().first > t.result.top().first
+                            || t.budget.exhausted(t.dist_count)) {
+                            while (t.result.size() > K) t.result.pop();
+                            for (int j = (int) t.result.size() - 1; j >= 0; j--) {
+                                ids[(size_t) i * K + j] = t.result.top().second;
+                                dists[(size_t) i * K + j] = t.result.top().first;
+                                t.result.pop();
+                            }
+                            truncated[i] = t.budget.truncated();
+                            dist_count += t.dist_count;
+                            t.phase = DONE;
+                            active--;
+                            break;
+                        }
+                        t.links = index->GetLevel0Links(t.candidates.top().second);
+                        t.candidates.pop();
+                        hop_count++;
+                        Index::Prefetch(t.links, (index->frozen_m0_ + 1) * sizeof(unsigned));
+                        t.phase = VISIT;
+                        break;
+                    case VISIT:
+                        t.todo.clear();
+                        for (unsigned j = 1; j <= t.links[0]; j++) {
+                            unsigned id = t.links[j];
+                            if (t.visited->Visited(id)) continue;
+                            t.visited->MarkAsVisited(id);
+                            t.todo.push_back(id);
+                            Index::Prefetch(index->getBaseData() + (size_t) id * dim, dim * sizeof(float));
+                        }
+                        t.phase = COMPUTE;
+                        break;
+                    case DONE:
+                        break;
+                }
+            }
+        }
+
+        index->addDistCount(dist_count);
+        index->addHopCount(hop_count);
+    }
+
+    /**
+     * 上层贪婪下降
+     * @param query 查询向量
+     * @param dist 返回点的距离
+     * @return 第 1 层上距查询最近的点，作为第 0 层入口
+     */
+    unsigned ComponentSearchRouteHNSW::SearchUpperLayers(const float *query, float &dist) {
+        // 计数先在本地累加，避免多线程批量搜索时争用同一缓存行
+        unsigned dist_count = 1, hop_count = 0;
 
+        unsigned cur_node = index->frozen_enterpoint_;
+        float cur_dist = index->getDist()->compare(query,
+                                                   index->getBaseData() + (size_t) cur_node * index->getBaseDim(),
+                                                   index->getBaseDim());
+
+        for (int i = index->max_level_; i > 0; --i) {
             bool changed = true;
             while (changed) {
                 changed = false;
-                std::unique_lock<std::mutex> local_lock(cur_node->GetAccessGuard());
-                const std::vector<Index::HnswNode *> &neighbors = cur_node->GetFriends(i);
-
-                for (auto iter = neighbors.begin(); iter != neighbors.end(); ++iter) {
-                    if(visited[(*iter)->GetId()] != visited_mark) {
-                        visited[(*iter)->GetId()] = visited_mark;
-                        d = index->getDist()->compare(index->getQueryData() + query * index->getQueryDim(),
-                                                      index->getBaseData() + (*iter)->GetId() * index->getBaseDim(),
-                                                      index->getBaseDim());
-                        index->addDistCount();
-                        if (d < cur_dist) {
-                            cur_dist = d;
-                            cur_node = *iter;
-                            changed = true;
-                            ensure_k_path_.emplace_back(cur_node, cur_dist);
-                        }
+                const unsigned *links = index->GetUpperLinks(cur_node, i);
+                hop_count++;
+
+                for (unsigned j = 1; j <= links[0]; j++) {
+                    float d = index->getDist()->compare(query,
+                                                        index->getBaseData() + (size_t) links[j] * index->getBaseDim(),
+                                                        index->getBaseDim());
+                    dist_count++;
+                    if (d < cur_dist) {
+                        cur_dist = d;
+                        cur_node = links[j];
+                        changed = true;
                     }
                 }
             }
         }
 
-        //std::cout << "ensure_k : " << ensure_k_path_.size() << " " << ensure_k_path_[0].first->GetId() << std::endl;
+        index->addDistCount(dist_count);
+        index->addHopCount(hop_count);
 
-        std::vector<std::pair<Index::HnswNode*, float>> tmp;
+        dist = cur_dist;
+        return cur_node;
+    }
 
-        while(tmp.size() < K && !ensure_k_path_.empty()) {
-            cur_dist = ensure_k_path_.back().second;
-            //std::cout << ensure_k_path_.back().first->GetId() << " ";
-            ensure_k_path_.pop_back();
-            SearchById_(query, ensure_k_path_.back().first, cur_dist, K, L, tmp);
-        }
-        //std::cout << std::endl;
+    /**
+     * 在第 0 层上做 ef 搜索
+     * @param query 查询向量
+     * @param enterpoint 上层下降得到的入口点
+     * @param enter_dist 入口点距离
+     * @param ef 候选集大小
+     * @param visited_list 访问标记
+     * @param budget 搜索预算，耗尽时停止扩展
+     * @param result 距离最近的 ef 个点（大顶堆）
+     */
+    void ComponentSearchRouteHNSW::SearchAtLayer0(const float *query, unsigned enterpoint, float enter_dist, unsigned ef,
+                                                  Index::VisitedList *visited_list, Index::SearchBudget &budget,
+                                                  std::priority_queue<std::pair<float, unsigned>> &result) {
+        typedef std::pair<float, unsigned> DistId;
+        std::priority_queue<DistId, std::vector<DistId>, std::greater<DistId>> candidates;
+        unsigned dist_count = 0, hop_count = 0;
 
-        for(auto ret : tmp) {
-//            std::cout << ret.first << "";
-            res.push_back(ret.first->GetId());
+        visited_list->Reset();
+        visited_list->MarkAsVisited(enterpoint);
+        result.emplace(enter_dist, enterpoint);
+        candidates.emplace(enter_dist, enterpoint);
+
+        while (!candidates.empty()) {
+            DistId candidate = candidates.top();
+            if (candidate.first > result.top().first || budget.exhausted(dist_count)) break;
+            candidates.pop();
+
+            const unsigned *links = index->GetLevel0Links(candidate.second);
+            hop_count++;
+
+            for (unsigned j = 1; j <= links[0]; j++) {
+                unsigned id = links[j];
+                if (visited_list->Visited(id)) continue;
+                visited_list->MarkAsVisited(id);
+
+                float d = index->getDist()->compare(query, index->getBaseData() + (size_t) id * index->getBaseDim(),
+                                                    index->getBaseDim());
+                dist_count++;
+                if (result.size() < ef || d < result.top().first) {
+                    candidates.emplace(d, id);
+                    result.emplace(d, id);
+                    if (result.size() > ef) result.pop();
+                }
+            }
         }
-//        std::cout << std::endl;
 
-        delete visited_list;
+        index->addDistCount(dist_count);
+        index->addHopCount(hop_count);
     }
 
-    void ComponentSearchRouteHNSW::SearchById_(unsigned query, Index::HnswNode* cur_node, float cur_dist, size_t k,
-                                                   size_t ef_search, std::vector<std::pair<Index::HnswNode*, float>> &result) {
-        Index::IdDistancePairMinHeap candidates;
-        Index::IdDistancePairMinHeap visited_nodes;
+    void ComponentSearchRouteHNSW::GetNeighbors(unsigned id, std::vector<unsigned> &neighbors) {
+        const unsigned *links = index->GetLevel0Links(id);
+        neighbors.assign(links + 1, links + 1 + links[0]);
+    }
 
-        candidates.emplace(cur_node, cur_dist);
+    /**
+     * 带过滤的 HNSW 搜索：上层照常下降，第 0 层的 ef 搜索照常导航，另以大顶堆只保留满足过滤条件的最近 K 个点
+     * @param query 查询点
+     * @param pool 入口点（未使用）
+     * @param filter 过滤位图
+     * @param ids 结果 id
+     * @param dists 结果距离
+     */
+    void ComponentSearchRouteHNSW::RouteFiltered(unsigned query, std::vector<Index::Neighbor> &pool,
+                                                 const boost::dynamic_bitset<> &filter, unsigned *ids, float *dists) {
+        const auto K = index->getParam().get<unsigned>("K_search");
+        const auto L = index->getParam().get<unsigned>("L_search");
+        const unsigned ef = std::max(L, K);
+        const unsigned dim = index->getBaseDim();
 
-        auto *visited_list_ = new Index::VisitedList(index->getBaseLen());
+        Index::VisitedList *visited_list = GetVisitedLists(1, index->getBaseLen())[0].get();
+        visited_list->Reset();
 
-        visited_list_->Reset();
-        unsigned int visited_mark = visited_list_->GetVisitMark();
-        unsigned int* visited = visited_list_->GetVisited();
+        const float *query_data = index->getQueryData() + (size_t) query * index->getQueryDim();
+        float enter_dist;
+        unsigned enterpoint = SearchUpperLayers(query_data, enter_dist);
 
-        size_t already_visited_for_ensure_k = 0;
-        if (!result.empty()) {
-            already_visited_for_ensure_k = result.size();
-            for (size_t i = 0; i < result.size(); ++i) {
-                if (result[i].first->GetId() == cur_node->GetId()) {
-                    return ;
-                }
-                visited[result[i].first->GetId()] = visited_mark;
-                visited_nodes.emplace(std::move(result[i]));
-            }
-            result.clear();
-        }
-        visited[cur_node->GetId()] = visited_mark;
-        //std::cout << "wtf" << std::endl;
+        typedef std::pair<float, unsigned> DistId;
+        std::priority_queue<DistId> top, matched;
+        std::priority_queue<DistId, std::vector<DistId>, std::greater<DistId>> candidates;
+        unsigned dist_count = 0, hop_count = 0;
+
+        visited_list->MarkAsVisited(enterpoint);
+        top.emplace(enter_dist, enterpoint);
+        candidates.emplace(enter_dist, enterpoint);
+        if (filter[enterpoint]) matched.emplace(enter_dist, enterpoint);
 
-        float farthest_distance = cur_dist;
-        size_t total_size = 1;
-        while (!candidates.empty() && visited_nodes.size() < ef_search+already_visited_for_ensure_k) {
-            //std::cout << "wtf1" << std::endl;
-            const Index::IdDistancePair& c = candidates.top();
-            cur_node = c.first;
-            visited_nodes.emplace(std::move(const_cast<Index::IdDistancePair&>(c)));
+        while (!candidates.empty()) {
+            DistId candidate = candidates.top();
+            if (candidate.first > top.top().first) break;
             candidates.pop();
 
-            float minimum_distance = farthest_distance;
-            int size = cur_node->GetFriends(0).size();
-
-            //std::cout << "wtf2" << std::endl;
-            for (auto j = 1; j < size; ++j) {
-                int node_id = cur_node->GetFriends(0)[j]->GetId();
-                //std::cout << "wtf4" << std::endl;
-                if (visited[node_id] != visited_mark) {
-                    visited[node_id] = visited_mark;
-                    //std::cout << "wtf5" << std::endl;
-                    float d = index->getDist()->compare(index->getQueryData() + index->getQueryDim() * query,
-                                                        index->getBaseData() + index->getBaseDim() * node_id,
-                                                        index->getBaseDim());
-                    index->addDistCount();
-                    //std::cout << "wtf6" << std::endl;
-                    if (d < minimum_distance || total_size < ef_search) {
-                        candidates.emplace(cur_node->GetFriends(0)[j], d);
-                        if (d > farthest_distance) {
-                            farthest_distance = d;
-                        }
-                        ++total_size;
-                    }
-                    //std::cout << "wtf7" << std::endl;
+            const unsigned *links = index->GetLevel0Links(candidate.second);
+            hop_count++;
+
+            for (unsigned j = 1; j <= links[0]; j++) {
+                unsigned id = links[j];
+                if (visited_list->Visited(id)) continue;
+                visited_list->MarkAsVisited(id);
+
+                float d = index->getDist()->compare(query_data, index->getBaseData() + (size_t) id * dim, dim);
+                dist_count++;
+                if (filter[id] && (matched.size() < K || d < matched.top().first)) {
+                    matched.emplace(d, id);
+                    if (matched.size() > K) matched.pop();
+                }
+                if (top.size() < ef || d < top.top().first) {
+                    candidates.emplace(d, id);
+                    top.emplace(d, id);
+                    if (top.size() > ef) top.pop();
                 }
             }
-            //std::cout << "wtf3" << std::endl;
         }
 
-        //std::cout << "wtf" <<std::endl;
+        index->addDistCount(dist_count);
+        index->addHopCount(hop_count);
 
-        while (result.size() < k) {
-            if (!candidates.empty() && !visited_nodes.empty()) {
-                const Index::IdDistancePair& c = candidates.top();
-                const Index::IdDistancePair& v = visited_nodes.top();
-                if (c.second < v.second) {
-                    result.emplace_back(std::move(const_cast<Index::IdDistancePair&>(c)));
-                    candidates.pop();
-                } else {
-                    result.emplace_back(std::move(const_cast<Index::IdDistancePair&>(v)));
-                    visited_nodes.pop();
-                }
-            } else if (!candidates.empty()) {
-                const Index::IdDistancePair& c = candidates.top();
-                result.emplace_back(std::move(const_cast<Index::IdDistancePair&>(c)));
-                candidates.pop();
-            } else if (!visited_nodes.empty()) {
-                const Index::IdDistancePair& v = visited_nodes.top();
-                result.emplace_back(std::move(const_cast<Index::IdDistancePair&>(v)));
-                visited_nodes.pop();
-            } else {
-                break;
-            }
+        for (int i = (int) matched.size() - 1; i >= 0; i--) {
+            ids[i] = matched.top().second;
+            dists[i] = matched.top().first;
+            matched.pop();
         }
     }
 
@@ -318,10 +835,11 @@ namespace weavess {
      * IEH 搜索
      * @param query 查询点
      * @param pool
-     * @param res
+     * @param ids 结果 id
+     * @param dists 结果距离
      */
-    void ComponentSearchRouteIEH::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool,
-                                             std::vector<unsigned int> &result) {
+    bool ComponentSearchRouteIEH::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                             float *dists) {
 
         const auto L = index->getParam().get<unsigned>("L_search");
         const auto K = index->getParam().get<unsigned>("K_search");
@@ -347,6 +865,7 @@ namespace weavess {
             std::vector<int> ids;
             for (int j = 0; it != cands.rend() && j < expand; it++, j++) {
                 int neighbor = it->row_id;
+                index->addHopCount();
                 auto nnit = index->knntable[neighbor].rbegin();
                 for (int k = 0; nnit != index->knntable[neighbor].rend() && k < expand; nnit++, k++) {
                     int nn = nnit->row_id;
@@ -364,8 +883,10 @@ namespace weavess {
 
         auto it = cands.rbegin();
         for(int j = 0; it != cands.rend() && j < K; it++, j++){
-            result.push_back(it->row_id);
+            ids[j] = it->row_id;
+            dists[j] = it->distance;
         }
+        return false;
     }
 
 
@@ -373,10 +894,11 @@ namespace weavess {
      * Backtrack 搜索
      * @param query 查询点
      * @param pool 入口点
-     * @param res 结果集
+     * @param ids 结果 id
+     * @param dists 结果距离
      */
-    void ComponentSearchRouteBacktrack::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool,
-                                                   std::vector<unsigned int> &res) {
+    bool ComponentSearchRouteBacktrack::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                                   float *dists) {
         const auto L = index->getParam().get<unsigned>("L_search");
         const auto K = index->getParam().get<unsigned>("K_search");
 
@@ -404,6 +926,7 @@ namespace weavess {
             //std::cout << 1 << std::endl;
             unsigned top_node = queue.top().GetNode();
             queue.pop();
+            index->addHopCount();
 
             // 未访问
             if(!flags[top_node]) {
@@ -453,22 +976,234 @@ namespace weavess {
 
         int i = 0;
         while(!full.empty() && i < K) {
-            res.push_back(full.top().GetNode());
+            ids[i] = full.top().GetNode();
+            dists[i] = full.top().GetDistance();
             full.pop();
             i ++;
         }
         //std::cout << 5 << std::endl;
+        return false;
     }
 
 
+    /**
+     * 束搜索：每轮同时扩展候选池中最近的 beam_width（默认 4）个未扩展候选，各候选的邻居由不同线程计算距离，
+     * 访问标记共享且原子更新，每轮结束后统一插入候选池。单个查询可利用空闲核心降低延迟，
+     * 在批量搜索等已处于并行区域内时退化为单线程
+     * @param query 查询点
+     * @param pool 入口点
+     * @param ids 结果 id
+     * @param dists 结果距离
+     * @return 是否因搜索预算耗尽而截断
+     */
+    bool ComponentSearchRouteBeam::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                              float *dists) {
+        const auto L = index->getParam().get<unsigned>("L_search");
+        const auto K = index->getParam().get<unsigned>("K_search");
+        const auto W = std::max(1u, index->getParam().get<unsigned>("beam_width", 4));
+        const unsigned dim = index->getBaseDim();
+
+        // 访问表属于发起查询的线程，并行区域内经指针共享
+        static thread_local std::unique_ptr<Index::AtomicVisitedList> visited_list;
+        if (!visited_list || visited_list->GetSize() != index->getBaseLen()) {
+            visited_list.reset(new Index::AtomicVisitedList(index->getBaseLen()));
+        }
+        Index::AtomicVisitedList *visited = visited_list.get();
+        visited->Reset();
+
+        Index::CandidatePool candidates(L);
+        for (unsigned i = 0; i < L && i < pool.size(); i++) {
+            unsigned id = pool[i].id;
+            if (id >= index->getBaseLen() || !visited->TryVisit(id)) continue;
+            candidates.insert(id, pool[i].distance, !pool[i].flag);
+        }
+
+        const float *query_data = index->getQueryData() + (size_t) query * index->getQueryDim();
+        std::vector<unsigned> frontier;
+        std::vector<std::vector<Index::SimpleNeighbor>> found(W);
+        unsigned dist_count = 0, hop_count = 0;
+        Index::SearchBudget budget = GetBudget();
+        const bool parallel = W > 1 && omp_get_max_threads() > 1 && !omp_in_parallel();
+
+        auto expand = [&](unsigned f) {
+            found[f].clear();
+            for (unsigned id : index->getLoadGraph()[frontier[f]]) {
+                if (!visited->TryVisit(id)) continue;
+                float dist = index->getDist()->compare(query_data, index->getBaseData() + (size_t) id * dim, dim);
+                found[f].emplace_back(id, dist);
+            }
+        };
+
+        while (candidates.has_unexpanded() && !budget.exhausted(dist_count)) {
+            frontier.clear();
+            while (frontier.size() < W && candidates.has_unexpanded()) {
+                frontier.push_back(candidates.pop());
+            }
+            hop_count += frontier.size();
+
+            const unsigned frontier_size = frontier.size();
+            if (parallel && frontier_size > 1) {
+#pragma omp parallel for schedule(dynamic, 1)
+                for (unsigned f = 0; f < frontier_size; f++) {
+                    expand(f);
+                }
+            } else {
+                for (unsigned f = 0; f < frontier_size; f++) {
+                    expand(f);
+                }
+            }
+
+            for (unsigned f = 0; f < frontier_size; f++) {
+                dist_count += found[f].size();
+                for (const auto &nn : found[f]) {
+                    if (nn.distance >= candidates.bound()) continue;
+                    candidates.insert(nn.id, nn.distance);
+                }
+            }
+        }
+
+        index->addDistCount(dist_count);
+        index->addHopCount(hop_count);
+
+        for (unsigned i = 0; i < K && i < candidates.size(); i++) {
+            ids[i] = candidates.id(i);
+            dists[i] = candidates.distance(i);
+        }
+        return budget.truncated();
+    }
+
+    /**
+     * 磁盘束搜索（DiskANN）：以内存中的 SQ8 压缩距离维护候选池，每轮取最近的 beam_width（默认 4）个未扩展候选，
+     * 批量异步读取其结点块，用块内原始向量计算精确距离，邻居按压缩距离入池；
+     * 结果为已读取结点按精确距离重排的前 K 个。入口为磁盘索引保存的导航点，忽略 pool
+     * @param query 查询点
+     * @param pool 入口点（未使用）
+     * @param ids 结果 id
+     * @param dists 结果距离
+     * @return 是否因搜索预算耗尽而截断
+     */
+    bool ComponentSearchRouteDisk::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                              float *dists) {
+        const auto L = index->getParam().get<unsigned>("L_search");
+        const auto K = index->getParam().get<unsigned>("K_search");
+        const auto W = std::max(1u, index->getParam().get<unsigned>("beam_width", 4));
+        const unsigned dim = index->getBaseDim();
+        if (index->disk_fd_ < 0) {
+            std::cerr << "disk index is not loaded" << std::endl;
+            exit(-1);
+        }
+
+        const float *query_data = index->getQueryData() + (size_t) query * index->getQueryDim();
+        std::vector<float> shifted(dim);
+        for (unsigned d = 0; d < dim; d++) shifted[d] = query_data[d] - index->disk_min_[d];
+        auto approx = [&](unsigned id) {
+            const uint8_t *code = index->disk_codes_.data() + (size_t) id * dim;
+            float result = 0;
+            for (unsigned d = 0; d < dim; d++) {
+                float t = shifted[d] - code[d] * index->disk_scale_[d];
+                result += t * t;
+            }
+            return result;
+        };
+
+        Index::VisitedList *visited_list = GetVisitedLists(1, index->getBaseLen())[0].get();
+        visited_list->Reset();
+
+        Index::CandidatePool candidates(L);
+        const unsigned entry = index->disk_entry_;
+        visited_list->MarkAsVisited(entry);
+        candidates.insert(entry, approx(entry));
+
+        static thread_local std::vector<char> buffer;
+        buffer.resize((size_t) W * index->disk_node_size_);
+        std::vector<unsigned> frontier;
+        std::vector<Index::SimpleNeighbor> exact;
+        unsigned hop_count = 0;
+        Index::SearchBudget budget = GetBudget();
+
+        while (candidates.has_unexpanded() && !budget.exhausted(exact.size())) {
+            frontier.clear();
+            while (frontier.size() < W && candidates.has_unexpanded()) {
+                frontier.push_back(candidates.pop());
+            }
+            hop_count += frontier.size();
+            ReadNodes(frontier, buffer.data());
+
+            for (unsigned f = 0; f < frontier.size(); f++) {
+                const auto *vec = (const float *) (buffer.data() + (size_t) f * index->disk_node_size_);
+                const auto *links = (const unsigned *) (vec + dim);
+                exact.emplace_back(frontier[f], index->getDist()->compare(query_data, vec, dim));
+
+                for (unsigned j = 1; j <= links[0]; j++) {
+                    unsigned id = links[j];
+                    if (visited_list->Visited(id)) continue;
+                    visited_list->MarkAsVisited(id);
+                    float dist = approx(id);
+                    if (dist >= candidates.bound()) continue;
+                    candidates.insert(id, dist);
+                }
+            }
+        }
+
+        index->addDistCount(exact.size());
+        index->addHopCount(hop_count);
+
+        const unsigned num = std::min((unsigned) exact.size(), K);
+        std::partial_sort(exact.begin(), exact.begin() + num, exact.end());
+        for (unsigned i = 0; i < num; i++) {
+            ids[i] = exact[i].id;
+            dists[i] = exact[i].distance;
+        }
+        return budget.truncated();
+    }
+
+    /**
+     * 读取一轮扩展的结点块到 buffer，多个结点经 POSIX AIO 一次提交并等待全部完成
+     * @param nodes 结点 id
+     * @param buffer 结点块缓冲区，nodes.size() * 结点块大小
+     */
+    void ComponentSearchRouteDisk::ReadNodes(const std::vector<unsigned> &nodes, char *buffer) {
+        const int fd = index->disk_fd_;
+        const size_t node_size = index->disk_node_size_;
+        if (nodes.size() == 1) {
+            if (pread(fd, buffer, node_size, index->DiskNodeOffset(nodes[0])) != (ssize_t) node_size) {
+                std::cerr << "read disk index error" << std::endl;
+                exit(-1);
+            }
+            return;
+        }
+
+        static thread_local std::vector<struct aiocb> requests;
+        static thread_local std::vector<struct aiocb *> list;
+        requests.assign(nodes.size(), aiocb());
+        list.resize(nodes.size());
+        for (unsigned i = 0; i < nodes.size(); i++) {
+            requests[i].aio_fildes = fd;
+            requests[i].aio_offset = index->DiskNodeOffset(nodes[i]);
+            requests[i].aio_buf = buffer + i * node_size;
+            requests[i].aio_nbytes = node_size;
+            requests[i].aio_lio_opcode = LIO_READ;
+            list[i] = &requests[i];
+        }
+        bool ok = lio_listio(LIO_WAIT, list.data(), (int) nodes.size(), nullptr) == 0;
+        for (unsigned i = 0; ok && i < nodes.size(); i++) {
+            ok = aio_return(&requests[i]) == (ssize_t) node_size;
+        }
+        if (!ok) {
+            std::cerr << "read disk index error" << std::endl;
+            exit(-1);
+        }
+    }
+
     /**
      * Guided 搜索
      * @param query 查询点
      * @param pool 入口点
-     * @param res 结果集
+     * @param ids 结果 id
+     * @param dists 结果距离
      */
-    void ComponentSearchRouteGuided::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool,
-                                                std::vector<unsigned int> &res) {
+    bool ComponentSearchRouteGuided::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                                float *dists) {
         const auto L = index->getParam().get<unsigned>("L_search");
         const auto K = index->getParam().get<unsigned>("K_search");
 
@@ -481,6 +1216,7 @@ namespace weavess {
             if (pool[k].flag) {
                 pool[k].flag = false;
                 unsigned n = pool[k].id;
+                index->addHopCount();
 
                 unsigned div_dim_ = index->Tn[n].div_dim;
                 unsigned left_len = index->Tn[n].left.size();
@@ -526,10 +1262,11 @@ namespace weavess {
 //        std::cout << std::endl;
 //        std::cout << std::endl;
 
-        res.resize(K);
         for (size_t i = 0; i < K; i++) {
-            res[i] = pool[i].id;
+            ids[i] = pool[i].id;
+            dists[i] = pool[i].distance;
         }
+        return false;
     }
 
 
@@ -537,7 +1274,8 @@ namespace weavess {
      * SPTAG-KDT 搜索
      * @param query 查询点
      * @param pool 入口点
-     * @param res 结果集
+     * @param ids 结果 id
+     * @param dists 结果距离
      */
     void ComponentSearchRouteSPTAG_KDT::KDTSearch(unsigned int query, int node, Index::Heap &m_NGQueue,
                                                   Index::Heap &m_SPTQueue, Index::OptHashPosVector &nodeCheckStatus,
@@ -579,8 +1317,8 @@ namespace weavess {
         KDTSearch(query, bestChild, m_NGQueue, m_SPTQueue, nodeCheckStatus, m_iNumberOfCheckedLeaves, m_iNumberOfTreeCheckedLeaves);
     }
 
-    void ComponentSearchRouteSPTAG_KDT::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool,
-                                                   std::vector<unsigned int> &result) {
+    bool ComponentSearchRouteSPTAG_KDT::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                                   float *dists) {
 
         const auto L = index->getParam().get<unsigned>("L_search");
         const auto K = index->getParam().get<unsigned>("K_search");
@@ -607,6 +1345,8 @@ namespace weavess {
         nodeCheckStatus.CheckAndSet(query);
 
         Index::QueryResultSet p_query(L);
+        // 预算按检查的叶子数（即距离计算次数）计
+        Index::SearchBudget budget = GetBudget();
 
         // InitSearchTrees 根据 KDT 获取入口点
         for(int i = 0; i < index->m_iTreeNumber; i ++) {
@@ -623,19 +1363,19 @@ namespace weavess {
             KDTSearch(query, tcell.node, m_NGQueue, m_SPTQueue, nodeCheckStatus, m_iNumberOfCheckedLeaves, m_iNumberOfTreeCheckedLeaves);
         }
 
-        while (!m_NGQueue.empty()) {
+        while (!m_NGQueue.empty() && !budget.exhausted(m_iNumberOfCheckedLeaves)) {
             Index::HeapCell gnode = m_NGQueue.pop();
             std::vector<Index::SimpleNeighbor> node = index->getFinalGraph()[gnode.node];
+            index->addHopCount();
 
             if (!p_query.AddPoint(gnode.node, gnode.distance) && m_iNumberOfCheckedLeaves > index->m_iMaxCheck) {
                 p_query.SortResult();
-                for(int i = 0; i < p_query.GetResultNum(); i ++) {
+                for(int i = 0; i < p_query.GetResultNum() && i < K; i ++) {
                     if(p_query.GetResult(i)->Dist == MaxDist) break;
-                    result.emplace_back(p_query.GetResult(i)->VID);
+                    ids[i] = p_query.GetResult(i)->VID;
+                    dists[i] = p_query.GetResult(i)->Dist;
                 }
-
-                result.resize(result.size() > K ? K : result.size());
-                return;
+                return false;
             }
             float upperBound = std::max(p_query.worstDist(), gnode.distance);
             bool bLocalOpt = true;
@@ -663,13 +1403,12 @@ namespace weavess {
             }
         }
         p_query.SortResult();
-        for(int i = 0; i < p_query.GetResultNum(); i ++) {
+        for(int i = 0; i < p_query.GetResultNum() && i < K; i ++) {
             if(p_query.GetResult(i)->Dist == MaxDist) break;
-            result.emplace_back(p_query.GetResult(i)->VID);
-            //std::cout << p_query.GetResult(i)->VID << "|" << p_query.GetResult(i)->Dist << " ";
+            ids[i] = p_query.GetResult(i)->VID;
+            dists[i] = p_query.GetResult(i)->Dist;
         }
-        //std::cout << std::endl;
-        result.resize(result.size() > K ? K : result.size());
+        return budget.truncated();
     }
 
     void ComponentSearchRouteSPTAG_BKT::BKTSearch(unsigned int query, Index::Heap &m_NGQueue,
@@ -707,10 +1446,12 @@ namespace weavess {
      * SPTAG-BKT 搜索
      * @param query 查询点
      * @param pool 入口点
-     * @param res 结果集
+     * @param ids 结果 id
+     * @param dists 结果距离
+     * @return 是否因搜索预算耗尽而截断
      */
-    void ComponentSearchRouteSPTAG_BKT::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool,
-                                                   std::vector<unsigned int> &result) {
+    bool ComponentSearchRouteSPTAG_BKT::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                                   float *dists) {
         const auto L = index->getParam().get<unsigned>("L_search");
         const auto K = index->getParam().get<unsigned>("K_search");
 
@@ -735,7 +1476,8 @@ namespace weavess {
         nodeCheckStatus.CheckAndSet(query);
 
         Index::QueryResultSet p_query(L);
-
+        // 预算按检查的叶子数（即距离计算次数）计
+        Index::SearchBudget budget = GetBudget();
 
         // InitSearchTrees 根据 BKT 获取入口点
         for (char i = 0; i < index->m_iTreeNumber; i++) {
@@ -762,10 +1504,11 @@ namespace weavess {
         BKTSearch(query, m_NGQueue, m_SPTQueue, nodeCheckStatus, m_iNumberOfCheckedLeaves, m_iNumberOfTreeCheckedLeaves, index->m_iNumberOfInitialDynamicPivots);
 
         const unsigned checkPos = index->getFinalGraph()[0].size() - 1;
-        while (!m_NGQueue.empty()) {
+        while (!m_NGQueue.empty() && !budget.exhausted(m_iNumberOfCheckedLeaves)) {
             Index::HeapCell gnode = m_NGQueue.pop();
             int tmpNode = gnode.node;
             std::vector<Index::SimpleNeighbor> node = index->getFinalGraph()[tmpNode];
+            index->addHopCount();
             if (gnode.distance <= p_query.worstDist()) {
                 int checkNode = node[checkPos].id;
                 if (checkNode < -1) {
@@ -780,12 +1523,12 @@ namespace weavess {
                 m_iNumOfContinuousNoBetterPropagation++;
                 if (m_iNumOfContinuousNoBetterPropagation > m_iContinuousLimit || m_iNumberOfCheckedLeaves > maxCheck) {
                     p_query.SortResult();
-                    for(int i = 0; i < p_query.GetResultNum(); i ++) {
+                    for(int i = 0; i < p_query.GetResultNum() && i < K; i ++) {
                         if(p_query.GetResult(i)->Dist == MaxDist) break;
-                        result.emplace_back(p_query.GetResult(i)->VID);
+                        ids[i] = p_query.GetResult(i)->VID;
+                        dists[i] = p_query.GetResult(i)->Dist;
                     }
-                    result.resize(result.size() > K ? K : result.size());
-                    return;
+                    return false;
                 }
             }
             for (unsigned i = 0; i <= checkPos; i++) {
@@ -804,21 +1547,24 @@ namespace weavess {
             }
         }
         p_query.SortResult();
-        for(int i = 0; i < p_query.GetResultNum(); i ++) {
+        for(int i = 0; i < p_query.GetResultNum() && i < K; i ++) {
             if(p_query.GetResult(i)->Dist == MaxDist) break;
-            result.emplace_back(p_query.GetResult(i)->VID);
+            ids[i] = p_query.GetResult(i)->VID;
+            dists[i] = p_query.GetResult(i)->Dist;
         }
-        result.resize(result.size() > K ? K : result.size());
+        return budget.truncated();
     }
 
     /**
      * NGT 搜索
      * @param query 查询点
      * @param pool 入口点
-     * @param res 结果集
+     * @param ids 结果 id
+     * @param dists 结果距离
+     * @return 是否因搜索预算耗尽而截断
      */
-    void ComponentSearchRouteNGT::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool,
-                                             std::vector<unsigned int> &res) {
+    bool ComponentSearchRouteNGT::RouteInner(unsigned int query, std::vector<Index::Neighbor> &pool, unsigned int *ids,
+                                             float *dists) {
         const auto L = index->getParam().get<unsigned>("L_search");
         const auto K = index->getParam().get<unsigned>("K_search");
 
@@ -854,19 +1600,22 @@ namespace weavess {
         }
 
         float explorationRadius = index->explorationCoefficient * radius;
+        Index::SearchBudget budget = GetBudget();
+        unsigned dist_count = 0;
 
         while (!unchecked.empty()){
             //std::cout << "radius: " << explorationRadius << std::endl;
             Index::Neighbor target = unchecked.top();
 
             unchecked.pop();
-            if (target.distance > explorationRadius){
+            if (target.distance > explorationRadius || budget.exhausted(dist_count)){
                 break;
             }
             std::vector<Index::SimpleNeighbor> neighbors = index->getFinalGraph()[target.id];
             if (neighbors.empty()){
                 continue;
             }
+            index->addHopCount();
 
             for (unsigned neighborptr = 0; neighborptr < neighbors.size(); ++neighborptr){
                 //sc.visitCount++;
@@ -880,6 +1629,7 @@ namespace weavess {
                                                            index->getBaseData() + index->getBaseDim() * neighbor.id,
                                                            index->getBaseDim());
                 index->addDistCount();
+                dist_count++;
                 //sc.distanceComputationCount++;
                 if (distance <= explorationRadius){
                     unchecked.push(Index::Neighbor(neighbor.id, distance, true));
@@ -902,16 +1652,16 @@ namespace weavess {
         while(!results.empty()) {
             //std::cout << results.top().id << "|" << results.top().distance << " ";
             if(results.size() <= K) {
-                res.push_back(results.top().id);
+                ids[results.size() - 1] = results.top().id;
+                dists[results.size() - 1] = results.top().distance;
             }
 
             results.pop();
         }
         //std::cout << std::endl;
 
-        sort(res.begin(), res.end());
-
         //sc.distanceComputationCount = so.distanceComputationCount;
         //sc.visitCount = so.visitCount;
+        return budget.truncated();
     }
 }
\ No newline at end of file
@@ -42,16 +42,24 @@ namespace weavess {
      */
     void ComponentSearchEntryCentroid::SearchEntryInner(unsigned int query, std::vector<Index::Neighbor> &pool) {
         const auto L = index->getParam().get<unsigned>("L_search");
-        pool.reserve(L + 1);
+        pool.resize(L + 1);
         std::vector<unsigned> init_ids(L);
         boost::dynamic_bitset<> flags{index->getBaseLen(), 0};
         // std::mt19937 rng(rand());
         // GenRandom(rng, init_ids.data(), L, (unsigned) index_->n_);
 
+        // 从文件载入的索引只有 LoadGraph
         unsigned tmp_l = 0;
-        for (; tmp_l < L && tmp_l < index->getFinalGraph()[index->ep_].size(); tmp_l++) {
-            init_ids[tmp_l] = index->getFinalGraph()[index->ep_][tmp_l].id;
-            flags[init_ids[tmp_l]] = true;
+        if (!index->getLoadGraph().empty()) {
+            for (; tmp_l < L && tmp_l < index->getLoadGraph()[index->ep_].size(); tmp_l++) {
+                init_ids[tmp_l] = index->getLoadGraph()[index->ep_][tmp_l];
+                flags[init_ids[tmp_l]] = true;
+            }
+        } else {
+            for (; tmp_l < L && tmp_l < index->getFinalGraph()[index->ep_].size(); tmp_l++) {
+                init_ids[tmp_l] = index->getFinalGraph()[index->ep_][tmp_l].id;
+                flags[init_ids[tmp_l]] = true;
+            }
         }
 
         while (tmp_l < L) {
@@ -0,0 +1,108 @@
+#include <weavess/builder.h>
+#include <weavess/exp_data.h>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+
+// 逗号分隔的列表，如 "10,20,40"
+template<typename T>
+std::vector<T> parse_list(const std::string &str) {
+    std::vector<T> list;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) continue;
+        std::stringstream conv(item);
+        T value;
+        conv >> value;
+        list.push_back(value);
+    }
+    return list;
+}
+
+// 入口点、路由策略名称，与扫描结果中的名称一致
+weavess::TYPE parse_type(const std::string &name, bool entry) {
+    static const std::vector<std::pair<std::string, weavess::TYPE>> entries = {
+            {"RAND", weavess::SEARCH_ENTRY_RAND}, {"CENTROID", weavess::SEARCH_ENTRY_CENTROID},
+            {"SUB_CENTROID", weavess::SEARCH_ENTRY_SUB_CENTROID}, {"KDT", weavess::SEARCH_ENTRY_KDT},
+            {"KDT_SINGLE", weavess::SEARCH_ENTRY_KDT_SINGLE}, {"NONE", weavess::SEARCH_ENTRY_NONE},
+            {"HASH", weavess::SEARCH_ENTRY_HASH}, {"VPT", weavess::SEARCH_ENTRY_VPT}};
+    static const std::vector<std::pair<std::string, weavess::TYPE>> routers = {
+            {"GREEDY", weavess::ROUTER_GREEDY}, {"NSW", weavess::ROUTER_NSW}, {"HNSW", weavess::ROUTER_HNSW},
+            {"IEH", weavess::ROUTER_IEH}, {"BACKTRACK", weavess::ROUTER_BACKTRACK}, {"GUIDED", weavess::ROUTER_GUIDE},
+            {"BEAM", weavess::ROUTER_BEAM}, {"DISK", weavess::ROUTER_DISK}, {"SPTAG_KDT", weavess::ROUTER_SPTAG_KDT},
+            {"SPTAG_BKT", weavess::ROUTER_SPTAG_BKT}, {"NGT", weavess::ROUTER_NGT}};
+    for (const auto &item : entry ? entries : routers) {
+        if (item.first == name) return item.second;
+    }
+    std::cerr << (entry ? "entry" : "router") << " input error: " << name << std::endl;
+    exit(-1);
+}
+
+/**
+ * 对 main 保存的图索引做 recall-QPS 扫描
+ * usage: benchmark <alg> <dataset> <result_file(.csv|.json)> [K] [L_list] [ec_list] [entry] [router] [incremental]
+ * entry / router 取扫描结果中的名称（如 CENTROID、GREEDY），省略或为 "-" 时使用该算法的默认组合；
+ * ec_list 为 "-" 时使用当前 explorationCoefficient；incremental 为 1 时按 L 续搜（仅 GREEDY）
+ * 数据集根目录取环境变量 WEAVESS_DATASET_ROOT
+ */
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cout << "usage: " << argv[0] << " <alg> <dataset> <result_file(.csv|.json)> [K] [L_list] [ec_list]"
+                     " [entry] [router] [incremental]\n";
+        std::cout << "dataset root is read from WEAVESS_DATASET_ROOT\n";
+        exit(-1);
+    }
+    const char *root = std::getenv("WEAVESS_DATASET_ROOT");
+    if (root == nullptr || root[0] == '\0') {
+        std::cerr << "WEAVESS_DATASET_ROOT is not set" << std::endl;
+        exit(-1);
+    }
+    weavess::Parameters parameters;
+    std::string dataset_root(root);
+    if (dataset_root.back() != '/') dataset_root += '/';
+    parameters.set<std::string>("dataset_root", dataset_root);
+    parameters.set<unsigned>("n_threads", 8);
+    std::string alg(argv[1]);
+    std::string dataset(argv[2]);
+    std::string result_file(argv[3]);
+    unsigned K = argc > 4 ? (unsigned) std::stoul(argv[4]) : 10;
+    std::vector<unsigned> L_list = parse_list<unsigned>(argc > 5 ? argv[5] : "10,20,40,60,80,100,150,200,300,400");
+    std::string ec_arg(argc > 6 ? argv[6] : "-");
+    std::vector<float> ec_list = parse_list<float>(ec_arg == "-" ? "" : ec_arg);
+    std::string entry_arg(argc > 7 ? argv[7] : "-");
+    std::string route_arg(argc > 8 ? argv[8] : "-");
+    bool incremental = argc > 9 && std::string(argv[9]) == "1";
+    std::cout << "algorithm: " << alg << std::endl;
+    std::cout << "dataset: " << dataset << std::endl;
+    std::string graph_file(alg + "_" + dataset + ".graph");
+    set_para(alg, dataset, parameters);
+
+    weavess::TYPE index_type, entry_type, route_type;
+    if (alg == "kgraph") {
+        index_type = weavess::INDEX_KGRAPH, entry_type = weavess::SEARCH_ENTRY_RAND, route_type = weavess::ROUTER_GREEDY;
+    }else if (alg == "fanng") {
+        index_type = weavess::INDEX_FANNG, entry_type = weavess::SEARCH_ENTRY_RAND, route_type = weavess::ROUTER_BACKTRACK;
+    }else if (alg == "nsg") {
+        index_type = weavess::INDEX_NSG, entry_type = weavess::SEARCH_ENTRY_CENTROID, route_type = weavess::ROUTER_GREEDY;
+    }else if (alg == "ssg") {
+        index_type = weavess::INDEX_SSG, entry_type = weavess::SEARCH_ENTRY_SUB_CENTROID, route_type = weavess::ROUTER_GREEDY;
+    }else if (alg == "dpg") {
+        index_type = weavess::INDEX_DPG, entry_type = weavess::SEARCH_ENTRY_RAND, route_type = weavess::ROUTER_GREEDY;
+    }else {
+        std::cout << "alg input error!\n";
+        exit(-1);
+    }
+    if (entry_arg != "-") entry_type = parse_type(entry_arg, true);
+    if (route_arg != "-") route_type = parse_type(route_arg, false);
+
+    std::string base_path = parameters.get<std::string>("base_path");
+    std::string query_path = parameters.get<std::string>("query_path");
+    std::string ground_path = parameters.get<std::string>("ground_path");
+    auto *builder = new weavess::IndexBuilder(parameters.get<unsigned>("n_threads"));
+    builder -> load(&base_path[0], &query_path[0], &ground_path[0], parameters)
+            -> load_graph(index_type, &graph_file[0])
+            -> sweep(entry_type, route_type, K, L_list, ec_list, &result_file[0], incremental);
+
+    return 0;
+}